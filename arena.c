@@ -0,0 +1,71 @@
+
+#include "arena.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct arena_block {
+  struct arena_block *next;
+  size_t size; // bytes in data
+  size_t used; // bytes of data handed out
+  max_align_t data[];
+};
+
+#define MIN_BLOCK_SIZE 4096
+#define MAX_BLOCK_SIZE (1 << 20)
+
+struct arena *
+new_arena(void)
+{
+  struct arena *arena = malloc(sizeof *arena);
+  arena->blocks = NULL;
+  arena->block_size = MIN_BLOCK_SIZE;
+  return arena;
+}
+
+void
+delete_arena(struct arena *arena)
+{
+  struct arena_block *block = arena->blocks;
+  while (block) {
+    struct arena_block *next = block->next;
+    free(block);
+    block = next;
+  }
+  free(arena);
+}
+
+// Start a new block with room for at least size bytes. Blocks grow with the
+// arena, so the number of mallocs is logarithmic until we reach the maximum
+// block size.
+static void
+new_block(struct arena *arena, size_t size)
+{
+  size_t block_size = arena->block_size;
+  if (block_size < MAX_BLOCK_SIZE)
+    arena->block_size *= 2;
+  if (block_size < size)
+    block_size = size;
+
+  struct arena_block *block = malloc(sizeof *block + block_size);
+  block->next = arena->blocks;
+  block->size = block_size;
+  block->used = 0;
+  arena->blocks = block;
+}
+
+void *
+arena_alloc(struct arena *arena, size_t size, size_t align)
+{
+  assert(align && align <= _Alignof(max_align_t) && !(align & (align - 1)));
+
+  struct arena_block *block = arena->blocks;
+  size_t offset = block ? (block->used + align - 1) & ~(align - 1) : 0;
+  if (!block || offset + size > block->size) {
+    new_block(arena, size);
+    block = arena->blocks;
+    offset = 0;
+  }
+  block->used = offset + size;
+  return (char *)block->data + offset;
+}
@@ -0,0 +1,24 @@
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// An arena hands out memory by bumping a pointer through large blocks. There
+// is no way to free a single allocation; all the memory is released at once
+// when the arena is deleted.
+struct arena_block;
+struct arena {
+  struct arena_block *blocks; // the block we allocate from, then older ones
+  size_t block_size;          // size of the next block we allocate
+};
+
+struct arena *
+new_arena(void);
+void
+delete_arena(struct arena *arena);
+
+void *
+arena_alloc(struct arena *arena, size_t size, size_t align);
+
+#endif
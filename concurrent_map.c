@@ -0,0 +1,443 @@
+
+#include "concurrent_map.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// An entry holds the hash key followed by the key and the value, laid out
+// like the bins in open_addressing_map: inline if their type has a size and
+// as pointers otherwise.
+struct entry {
+  uint64_t hash_key;
+};
+
+// Deleted entries are replaced by a tombstone.
+static struct entry tombstone;
+#define TOMBSTONE (&tombstone)
+
+struct concurrent_bin {
+  _Atomic uint64_t hash_key;   // the entry's hash key, so we can skip it
+  struct entry *_Atomic entry; // NULL if the bin has never been used
+};
+
+struct concurrent_bins {
+  size_t size;
+  struct concurrent_bin bins[];
+};
+
+// Memory that is waiting for readers to leave their read sections.
+struct retired {
+  void *ptr;
+  bool is_bins; // bins or an entry
+  unsigned long epoch;
+};
+
+struct concurrent_shard {
+  _Alignas(64) pthread_mutex_t lock;
+  struct concurrent_bins *_Atomic bins;
+
+  // Only used with the lock held
+  size_t used;
+  size_t active;
+  struct retired *retired;
+  size_t no_retired;
+  size_t retired_size;
+};
+
+#define MIN_SIZE 8
+
+// We try to free retired memory every time this many more is retired.
+#define RECLAIM_BATCH 64
+
+// Helpers
+static inline uint64_t
+hash(struct concurrent_map *map, void const *key)
+{
+  struct key_type const *kt = map->key_type;
+  return kt->seeded_hash ? kt->seeded_hash(key, 0) : kt->hash(key);
+}
+
+// The top bits pick the shard and the bottom bits the bin in it.
+static inline struct concurrent_shard *
+get_shard(struct concurrent_map *map, uint64_t hash_key)
+{
+  size_t shard =
+      map->shard_bits ? hash_key >> (8 * sizeof hash_key - map->shard_bits) : 0;
+  return map->shards + shard;
+}
+
+static inline void *
+entry_key(struct concurrent_map *map, struct entry *entry)
+{
+  void *slot = (char *)entry + map->key_offset;
+  return map->key_type->size ? slot : *(void **)slot;
+}
+
+static inline void *
+entry_val(struct concurrent_map *map, struct entry *entry)
+{
+  void *slot = (char *)entry + map->val_offset;
+  return map->value_type->size ? slot : *(void **)slot;
+}
+
+static struct entry *
+new_entry(struct concurrent_map *map, uint64_t hash_key, void const *key,
+          void const *value)
+{
+  struct entry *entry = malloc(map->entry_size);
+  entry->hash_key = hash_key;
+
+  void *key_slot = (char *)entry + map->key_offset;
+  if (map->key_type->size)
+    memcpy(key_slot, key, map->key_type->size);
+  else
+    *(void **)key_slot = map->key_type->cpy(key);
+
+  void *val_slot = (char *)entry + map->val_offset;
+  if (map->value_type->size)
+    memcpy(val_slot, value, map->value_type->size);
+  else
+    *(void **)val_slot = map->value_type->cpy(value);
+
+  return entry;
+}
+
+static void
+free_entry(struct concurrent_map *map, struct entry *entry)
+{
+  if (!map->key_type->size)
+    map->key_type->del(entry_key(map, entry));
+  if (!map->value_type->size)
+    map->value_type->del(entry_val(map, entry));
+  free(entry);
+}
+
+static inline bool
+is_live(struct entry *entry)
+{
+  return entry && entry != TOMBSTONE;
+}
+
+static struct concurrent_bins *
+new_bins(size_t size)
+{
+  struct concurrent_bins *bins =
+      malloc(sizeof *bins + size * sizeof *bins->bins);
+  bins->size = size;
+  for (size_t i = 0; i < size; i++) {
+    atomic_init(&bins->bins[i].hash_key, 0);
+    atomic_init(&bins->bins[i].entry, NULL);
+  }
+  return bins;
+}
+
+static inline size_t
+align_up(size_t offset, size_t align)
+{
+  return (offset + align - 1) / align * align;
+}
+
+// Creating and deleting maps
+
+struct concurrent_map *
+new_concurrent_map(struct key_type const *key_type,
+                   struct value_type const *value_type,
+                   unsigned int no_shards)
+{
+  assert(no_shards && !(no_shards & (no_shards - 1)));
+
+  // Each thread slot has a cache line to itself, and malloc() doesn't promise
+  // to line them up.
+  struct concurrent_map *map =
+      aligned_alloc(_Alignof(struct concurrent_map),
+                    align_up(sizeof *map, _Alignof(struct concurrent_map)));
+  map->key_type = key_type;
+  map->value_type = value_type;
+  map->shard_bits = __builtin_ctz(no_shards);
+
+  size_t key_size = key_type->size ? key_type->size : sizeof(void *);
+  size_t key_align = key_type->size ? key_type->align : _Alignof(void *);
+  size_t val_size = value_type->size ? value_type->size : sizeof(void *);
+  size_t val_align = value_type->size ? value_type->align : _Alignof(void *);
+  map->key_offset = align_up(sizeof(struct entry), key_align);
+  map->val_offset = align_up(map->key_offset + key_size, val_align);
+  map->entry_size = map->val_offset + val_size;
+
+  atomic_init(&map->epoch, 1);
+  for (int i = 0; i < CONCURRENT_MAX_THREADS; i++) {
+    atomic_init(&map->threads[i].state, 0);
+    atomic_init(&map->threads[i].in_use, false);
+  }
+
+  map->shards = aligned_alloc(_Alignof(struct concurrent_shard),
+                              no_shards * sizeof *map->shards);
+  for (size_t i = 0; i < no_shards; i++) {
+    struct concurrent_shard *shard = map->shards + i;
+    pthread_mutex_init(&shard->lock, NULL);
+    atomic_init(&shard->bins, new_bins(MIN_SIZE));
+    shard->used = shard->active = 0;
+    shard->retired = NULL;
+    shard->no_retired = shard->retired_size = 0;
+  }
+
+  return map;
+}
+
+static void
+free_retired(struct concurrent_map *map, struct retired *retired)
+{
+  if (retired->is_bins)
+    free(retired->ptr);
+  else
+    free_entry(map, retired->ptr);
+}
+
+void
+delete_concurrent_map(struct concurrent_map *map)
+{
+  for (size_t i = 0; i < 1u << map->shard_bits; i++) {
+    struct concurrent_shard *shard = map->shards + i;
+    struct concurrent_bins *bins = atomic_load(&shard->bins);
+    for (size_t j = 0; j < bins->size; j++) {
+      struct entry *entry = atomic_load(&bins->bins[j].entry);
+      if (is_live(entry))
+        free_entry(map, entry);
+    }
+    free(bins);
+    for (size_t j = 0; j < shard->no_retired; j++) {
+      free_retired(map, shard->retired + j);
+    }
+    free(shard->retired);
+    pthread_mutex_destroy(&shard->lock);
+  }
+  free(map->shards);
+  free(map);
+}
+
+// Threads and epochs
+
+struct concurrent_thread *
+concurrent_register_thread(struct concurrent_map *map)
+{
+  for (int i = 0; i < CONCURRENT_MAX_THREADS; i++) {
+    bool in_use = false;
+    if (atomic_compare_exchange_strong(&map->threads[i].in_use, &in_use, true))
+      return map->threads + i;
+  }
+  return NULL; // every slot is taken
+}
+
+void
+concurrent_unregister_thread(struct concurrent_thread *thread)
+{
+  atomic_store(&thread->state, 0);
+  atomic_store(&thread->in_use, false);
+}
+
+void
+concurrent_read_begin(struct concurrent_map *map,
+                      struct concurrent_thread *thread)
+{
+  unsigned long epoch = atomic_load(&map->epoch);
+  atomic_store(&thread->state, epoch << 1 | 1);
+  // Writers must see that we are reading before we look at any bins
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+void
+concurrent_read_end(struct concurrent_thread *thread)
+{
+  atomic_store_explicit(&thread->state, 0, memory_order_release);
+}
+
+// Move to the next epoch if every thread that is reading started in the
+// current one, and return the epoch we end up in.
+static unsigned long
+try_advance_epoch(struct concurrent_map *map)
+{
+  // Pairs with the fence in concurrent_read_begin(): either we see a reader
+  // that has just started, or it sees the bins without what we unlinked.
+  atomic_thread_fence(memory_order_seq_cst);
+  unsigned long epoch = atomic_load(&map->epoch);
+  for (int i = 0; i < CONCURRENT_MAX_THREADS; i++) {
+    unsigned long state = atomic_load(&map->threads[i].state);
+    if ((state & 1) && state >> 1 != epoch)
+      return epoch;
+  }
+  if (atomic_compare_exchange_strong(&map->epoch, &epoch, epoch + 1))
+    return epoch + 1;
+  return epoch; // someone else moved it, and updated epoch
+}
+
+// Memory retired in epoch e was unlinked before any reader could start in
+// epoch e + 1, so once the epoch has moved to e + 2, every reader that could
+// have seen it is done with it.
+static void
+reclaim(struct concurrent_map *map, struct concurrent_shard *shard)
+{
+  unsigned long epoch = try_advance_epoch(map);
+  size_t i = 0;
+  for (; i < shard->no_retired && shard->retired[i].epoch + 2 <= epoch; i++) {
+    free_retired(map, shard->retired + i);
+  }
+  shard->no_retired -= i;
+  memmove(shard->retired, shard->retired + i,
+          shard->no_retired * sizeof *shard->retired);
+}
+
+// Put memory we have removed from the shard aside until it is safe to free.
+static void
+retire(struct concurrent_map *map, struct concurrent_shard *shard, void *ptr,
+       bool is_bins)
+{
+  if (shard->no_retired == shard->retired_size) {
+    shard->retired_size = shard->retired_size ? 2 * shard->retired_size
+                                              : RECLAIM_BATCH;
+    shard->retired = realloc(shard->retired,
+                             shard->retired_size * sizeof *shard->retired);
+  }
+  shard->retired[shard->no_retired++] = (struct retired){
+      .ptr = ptr, .is_bins = is_bins, .epoch = atomic_load(&map->epoch)};
+
+  if (shard->no_retired % RECLAIM_BATCH == 0)
+    reclaim(map, shard);
+}
+
+// Lookup
+
+void *
+concurrent_lookup_key(struct concurrent_map *map, void const *key)
+{
+  uint64_t hash_key = hash(map, key);
+  struct concurrent_shard *shard = get_shard(map, hash_key);
+  struct concurrent_bins *bins =
+      atomic_load_explicit(&shard->bins, memory_order_acquire);
+  size_t mask = bins->size - 1;
+
+  for (size_t i = 0; i < bins->size; i++) {
+    struct concurrent_bin *bin = bins->bins + ((hash_key + i) & mask);
+    struct entry *entry =
+        atomic_load_explicit(&bin->entry, memory_order_acquire);
+    if (!entry)
+      return NULL; // end of probe
+    if (entry == TOMBSTONE ||
+        atomic_load_explicit(&bin->hash_key, memory_order_relaxed) != hash_key)
+      continue;
+    // The bin's hash key is only a hint; the entry's is the real one.
+    if (entry->hash_key == hash_key &&
+        map->key_type->cmp(entry_key(map, entry), key))
+      return entry_val(map, entry);
+  }
+  return NULL;
+}
+
+// Writing. Everything below runs with the shard locked.
+
+// Find the bin holding the key, or, if it isn't in the shard, the first bin it
+// could go in.
+static struct concurrent_bin *
+find_bin(struct concurrent_map *map, struct concurrent_bins *bins,
+         uint64_t hash_key, void const *key)
+{
+  size_t mask = bins->size - 1;
+  struct concurrent_bin *free_bin = NULL;
+  for (size_t i = 0; i < bins->size; i++) {
+    struct concurrent_bin *bin = bins->bins + ((hash_key + i) & mask);
+    struct entry *entry =
+        atomic_load_explicit(&bin->entry, memory_order_relaxed);
+    if (!entry)
+      return free_bin ? free_bin : bin;
+    if (entry == TOMBSTONE) {
+      if (!free_bin)
+        free_bin = bin;
+    } else if (entry->hash_key == hash_key &&
+               map->key_type->cmp(entry_key(map, entry), key)) {
+      return bin;
+    }
+  }
+  assert(free_bin); // There is always an empty bin
+  return free_bin;
+}
+
+// Publish an entry in a bin. Readers that see the entry also see the hash key.
+static inline void
+store_entry(struct concurrent_bin *bin, struct entry *entry)
+{
+  atomic_store_explicit(&bin->hash_key, entry->hash_key, memory_order_relaxed);
+  atomic_store_explicit(&bin->entry, entry, memory_order_release);
+}
+
+// Copy the live entries to new bins and publish them. Readers might still be
+// probing the old bins, which hold the same entries.
+static void
+resize(struct concurrent_map *map, struct concurrent_shard *shard,
+       size_t new_size)
+{
+  struct concurrent_bins *old_bins =
+      atomic_load_explicit(&shard->bins, memory_order_relaxed);
+  struct concurrent_bins *bins = new_bins(new_size);
+  size_t mask = new_size - 1;
+  for (size_t i = 0; i < old_bins->size; i++) {
+    struct entry *entry =
+        atomic_load_explicit(&old_bins->bins[i].entry, memory_order_relaxed);
+    if (!is_live(entry))
+      continue;
+    size_t j = entry->hash_key & mask;
+    while (atomic_load_explicit(&bins->bins[j].entry, memory_order_relaxed)) {
+      j = (j + 1) & mask;
+    }
+    store_entry(bins->bins + j, entry);
+  }
+  shard->used = shard->active;
+
+  atomic_store_explicit(&shard->bins, bins, memory_order_release);
+  retire(map, shard, old_bins, true);
+}
+
+void
+concurrent_add_map(struct concurrent_map *map, void const *key,
+                   void const *value)
+{
+  uint64_t hash_key = hash(map, key);
+  struct concurrent_shard *shard = get_shard(map, hash_key);
+  struct entry *new = new_entry(map, hash_key, key, value);
+
+  pthread_mutex_lock(&shard->lock);
+  struct concurrent_bins *bins =
+      atomic_load_explicit(&shard->bins, memory_order_relaxed);
+  struct concurrent_bin *bin = find_bin(map, bins, hash_key, key);
+  struct entry *old = atomic_load_explicit(&bin->entry, memory_order_relaxed);
+  store_entry(bin, new);
+
+  if (is_live(old)) {
+    retire(map, shard, old, false);
+  } else {
+    shard->used += !old; // inc if the bin hasn't been used before
+    shard->active++;
+    if (shard->used > bins->size / 2)
+      resize(map, shard, bins->size * 2);
+  }
+  pthread_mutex_unlock(&shard->lock);
+}
+
+void
+concurrent_delete_key(struct concurrent_map *map, void const *key)
+{
+  uint64_t hash_key = hash(map, key);
+  struct concurrent_shard *shard = get_shard(map, hash_key);
+
+  pthread_mutex_lock(&shard->lock);
+  struct concurrent_bins *bins =
+      atomic_load_explicit(&shard->bins, memory_order_relaxed);
+  struct concurrent_bin *bin = find_bin(map, bins, hash_key, key);
+  struct entry *old = atomic_load_explicit(&bin->entry, memory_order_relaxed);
+  if (is_live(old)) { // find_bin only gives us a live bin if it has the key
+    atomic_store_explicit(&bin->entry, TOMBSTONE, memory_order_release);
+    retire(map, shard, old, false);
+    shard->active--;
+    if (shard->active < bins->size / 8 && bins->size > MIN_SIZE)
+      resize(map, shard, bins->size / 2);
+  }
+  pthread_mutex_unlock(&shard->lock);
+}
@@ -0,0 +1,72 @@
+
+#ifndef CONCURRENT_MAP_H
+#define CONCURRENT_MAP_H
+
+#include "open_addressing_map.h"
+#include <stdatomic.h>
+
+// A map that many threads can use at the same time, with the same key and
+// value types as open_addressing_map. Keys are spread over shards by their
+// hash key, and writers lock the shard they modify. Readers never lock.
+//
+// Entries are never modified once they are in a bin; writers replace them.
+// Memory a reader might still be looking at, replaced entries and the bins of
+// resized shards, is only freed when every reader that could have seen it has
+// left its read section (epoch-based reclamation).
+
+// A thread that reads from the map must register, and get one of these.
+#define CONCURRENT_MAX_THREADS 256
+struct concurrent_thread {
+  // Epoch the thread's read section started in (shifted left by one, with
+  // the low bit set) or zero if the thread isn't reading.
+  _Alignas(64) atomic_ulong state;
+  atomic_bool in_use;
+};
+
+struct concurrent_shard;
+struct concurrent_map {
+  struct concurrent_shard *shards;
+  unsigned int shard_bits; // log2 of the number of shards
+  size_t entry_size;
+  size_t key_offset;
+  size_t val_offset;
+  struct key_type const *key_type;
+  struct value_type const *value_type;
+
+  atomic_ulong epoch;
+  struct concurrent_thread threads[CONCURRENT_MAX_THREADS];
+};
+
+// no_shards must be a power of two.
+struct concurrent_map *
+new_concurrent_map(struct key_type const *key_type,
+                   struct value_type const *value_type,
+                   unsigned int no_shards);
+// No other thread can use the map while we delete it.
+void
+delete_concurrent_map(struct concurrent_map *map);
+
+// Returns NULL if CONCURRENT_MAX_THREADS threads are already registered.
+struct concurrent_thread *
+concurrent_register_thread(struct concurrent_map *map);
+void
+concurrent_unregister_thread(struct concurrent_thread *thread);
+
+// Lookups must happen in a read section, and the values they return are only
+// valid until the section ends.
+void
+concurrent_read_begin(struct concurrent_map *map,
+                      struct concurrent_thread *thread);
+void
+concurrent_read_end(struct concurrent_thread *thread);
+void *
+concurrent_lookup_key(struct concurrent_map *map, void const *key);
+
+// Writers don't need a read section.
+void
+concurrent_add_map(struct concurrent_map *map, void const *key,
+                   void const *value);
+void
+concurrent_delete_key(struct concurrent_map *map, void const *key);
+
+#endif
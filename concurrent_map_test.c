@@ -0,0 +1,135 @@
+#include "concurrent_map.h"
+#include "hash.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static void *
+u32_dup(void const *p)
+{
+  uint32_t *new = malloc(sizeof(uint32_t));
+  *new = *(uint32_t *)p;
+  return new;
+}
+
+static bool
+u32_cmp(void const *ap, void const *bp)
+{
+  uint32_t a = *(uint32_t *)ap;
+  uint32_t b = *(uint32_t *)bp;
+  return a == b;
+}
+
+struct key_type ui32_key_type = {
+    .cmp = u32_cmp, .del = free, .hash = hash_u32_key, .cpy = u32_dup};
+struct value_type ui32_val_type = {.del = free, .cpy = u32_dup};
+
+#define NO_WRITERS 2
+#define NO_READERS 4
+#define NO_ROUNDS 20
+
+struct concurrent_map *map;
+int no_elms;
+atomic_bool writing;
+
+// Each writer owns a range of keys, that it maps to themselves and deletes
+// again, and ends up with the even keys in the map.
+static void *
+writer(void *arg)
+{
+  uint32_t first = (uintptr_t)arg * no_elms;
+  for (int round = 0; round < NO_ROUNDS; ++round) {
+    for (uint32_t key = first; key < first + no_elms; ++key) {
+      concurrent_add_map(map, &key, &key);
+    }
+    for (uint32_t key = first; key < first + no_elms; ++key) {
+      if (round == NO_ROUNDS - 1 ? key % 2 : (key + round) % 3)
+        concurrent_delete_key(map, &key);
+    }
+  }
+  return NULL;
+}
+
+// Readers check that any key they find maps to itself, while the writers
+// replace and delete the entries under them.
+static void *
+reader(void *arg)
+{
+  struct concurrent_thread *thread = concurrent_register_thread(map);
+  assert(thread);
+  unsigned int seed = (uintptr_t)arg;
+  do {
+    concurrent_read_begin(map, thread);
+    for (int i = 0; i < no_elms; ++i) {
+      uint32_t key = rand_r(&seed) % (NO_WRITERS * no_elms);
+      uint32_t *val = concurrent_lookup_key(map, &key);
+      assert(!val || *val == key);
+    }
+    concurrent_read_end(thread);
+  } while (atomic_load(&writing));
+  concurrent_unregister_thread(thread);
+  return NULL;
+}
+
+int
+main(int argc, const char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: %s no_elements\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  no_elms = atoi(argv[1]);
+  map = new_concurrent_map(&ui32_key_type, &ui32_val_type, 4);
+  atomic_init(&writing, true);
+
+  clock_t start = clock();
+  pthread_t writers[NO_WRITERS], readers[NO_READERS];
+  for (uintptr_t i = 0; i < NO_READERS; ++i) {
+    pthread_create(&readers[i], NULL, reader, (void *)i);
+  }
+  for (uintptr_t i = 0; i < NO_WRITERS; ++i) {
+    pthread_create(&writers[i], NULL, writer, (void *)i);
+  }
+  for (int i = 0; i < NO_WRITERS; ++i) {
+    pthread_join(writers[i], NULL);
+  }
+  atomic_store(&writing, false);
+  for (int i = 0; i < NO_READERS; ++i) {
+    pthread_join(readers[i], NULL);
+  }
+  clock_t end = clock();
+  double elapsed_time = (end - start) / (double)CLOCKS_PER_SEC;
+  printf("%g\n", elapsed_time);
+
+  struct concurrent_thread *thread = concurrent_register_thread(map);
+  assert(thread);
+  concurrent_read_begin(map, thread);
+  for (uint32_t key = 0; key < NO_WRITERS * no_elms; ++key) {
+    uint32_t *val = concurrent_lookup_key(map, &key);
+    assert(key % 2 ? val == 0 : *val == key);
+  }
+  concurrent_read_end(thread);
+  concurrent_unregister_thread(thread);
+
+  // When every slot is taken, registering fails until one is given back.
+  struct concurrent_thread *threads[CONCURRENT_MAX_THREADS];
+  for (int i = 0; i < CONCURRENT_MAX_THREADS; ++i) {
+    threads[i] = concurrent_register_thread(map);
+    assert(threads[i]);
+  }
+  assert(!concurrent_register_thread(map));
+  concurrent_unregister_thread(threads[0]);
+  threads[0] = concurrent_register_thread(map);
+  assert(threads[0]);
+  for (int i = 0; i < CONCURRENT_MAX_THREADS; ++i) {
+    concurrent_unregister_thread(threads[i]);
+  }
+
+  delete_concurrent_map(map);
+
+  return EXIT_SUCCESS;
+}
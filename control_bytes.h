@@ -0,0 +1,138 @@
+
+#ifndef CONTROL_BYTES_H
+#define CONTROL_BYTES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Control bytes and group matching for the open addressing tables, both the
+// one in open_addressing_map.c and the ones GEN_OA_MAP generates.
+//
+// The state of each bin lives in a separate array of control bytes, so a probe
+// can test a whole group of bins at a time without touching the bins
+// themselves. A control byte is either CTRL_EMPTY (the bin is not part of a
+// probe sequence), CTRL_DELETED (the bin is in a probe sequence but does not
+// contain a value), or, for bins that hold a value, the top seven bits of the
+// hash key.
+#define CTRL_EMPTY ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xfe)
+
+// Groups of control bytes are matched with SSE2 (16 bins at a time) or AVX2
+// (32 bins at a time) when the compiler targets them. Define OA_MAP_NO_SIMD
+// to get the portable byte-at-a-time version instead.
+#if !defined(OA_MAP_NO_SIMD) && defined(__AVX2__)
+#define OA_MAP_AVX2
+#include <immintrin.h>
+#define GROUP_WIDTH 32
+#elif !defined(OA_MAP_NO_SIMD) && defined(__SSE2__)
+#define OA_MAP_SSE2
+#include <emmintrin.h>
+#define GROUP_WIDTH 16
+#else
+#define GROUP_WIDTH 16
+#endif
+
+// Control bytes
+static inline bool
+is_full(uint8_t ctrl)
+{
+  return !(ctrl & 0x80); // CTRL_EMPTY and CTRL_DELETED have the high bit set
+}
+
+static inline uint8_t
+h7(uint64_t hash_key)
+{
+  // The low bits pick the bin, so use the high bits as the fragment.
+  return hash_key >> (8 * sizeof hash_key - 7);
+}
+
+// Group matching. A group is the GROUP_WIDTH control bytes starting at some
+// bin, and a match is a mask with bit i set if the i'th byte matched.
+typedef uint32_t group_mask;
+#define GROUP_BINS ((group_mask)((1ull << GROUP_WIDTH) - 1)) // all bits set
+
+#if defined(OA_MAP_AVX2)
+static inline group_mask
+match_byte(uint8_t const *group, uint8_t b)
+{
+  __m256i ctrl = _mm256_loadu_si256((__m256i const *)group);
+  __m256i eq = _mm256_cmpeq_epi8(ctrl, _mm256_set1_epi8((char)b));
+  return (group_mask)_mm256_movemask_epi8(eq);
+}
+
+static inline group_mask
+match_empty_or_deleted(uint8_t const *group)
+{
+  __m256i ctrl = _mm256_loadu_si256((__m256i const *)group);
+  return (group_mask)_mm256_movemask_epi8(ctrl);
+}
+#elif defined(OA_MAP_SSE2)
+static inline group_mask
+match_byte(uint8_t const *group, uint8_t b)
+{
+  __m128i ctrl = _mm_loadu_si128((__m128i const *)group);
+  __m128i eq = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)b));
+  return (group_mask)_mm_movemask_epi8(eq);
+}
+
+static inline group_mask
+match_empty_or_deleted(uint8_t const *group)
+{
+  __m128i ctrl = _mm_loadu_si128((__m128i const *)group);
+  return (group_mask)_mm_movemask_epi8(ctrl);
+}
+#else
+static inline group_mask
+match_byte(uint8_t const *group, uint8_t b)
+{
+  group_mask mask = 0;
+  for (unsigned int i = 0; i < GROUP_WIDTH; i++) {
+    mask |= (group_mask)(group[i] == b) << i;
+  }
+  return mask;
+}
+
+static inline group_mask
+match_empty_or_deleted(uint8_t const *group)
+{
+  group_mask mask = 0;
+  for (unsigned int i = 0; i < GROUP_WIDTH; i++) {
+    mask |= (group_mask)(group[i] >> 7) << i;
+  }
+  return mask;
+}
+#endif
+
+static inline group_mask
+match_empty(uint8_t const *group)
+{
+  return match_byte(group, CTRL_EMPTY);
+}
+
+static inline unsigned int
+first_bit(group_mask mask)
+{
+  return __builtin_ctz(mask);
+}
+
+// Enough groups to cover all bins (small tables fit in a single group).
+static inline size_t
+no_groups(size_t size)
+{
+  return size / GROUP_WIDTH + 1;
+}
+
+// The first GROUP_WIDTH - 1 control bytes are mirrored after the last bin,
+// so a group can be loaded from any bin without wrapping around. In tables
+// smaller than a group, a bin is mirrored more than once.
+static inline void
+set_ctrl_byte(uint8_t *ctrl, size_t size, size_t i, uint8_t b)
+{
+  ctrl[i] = b;
+  for (size_t j = i; j < GROUP_WIDTH - 1; j += size) {
+    ctrl[size + j] = b;
+  }
+}
+
+#endif
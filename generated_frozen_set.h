@@ -0,0 +1,188 @@
+
+#ifndef GENERATED_FROZEN_SET_H
+#define GENERATED_FROZEN_SET_H
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "generated_hash_set.h"
+
+// Frozen sets are generated sets saved to a file that we map into memory
+// read-only and search where it is, without building anything, so processes
+// that load the same file share its pages. The keys of each bin are stored
+// one after the other, so a search reads one contiguous run of keys instead
+// of following links.
+//
+// The keys are written as they are, so KEY_TYPE must be plain data without
+// pointers, and the file is in the byte order of the machine that wrote it.
+// GEN_FROZEN_SET needs GEN_HASH_TABLE, or GEN_CACHED_HASH_TABLE, with the
+// same HASH_NAME, KEY_TYPE, KEY_CMP and HASH first. NAME_save_table() returns
+// false if the file can't be written, and NAME_load_frozen() returns NULL if
+// it can't map the file or the file wasn't saved from a set with the same key
+// type.
+
+#define FROZEN_SET(HASH_NAME) struct HASH_NAME##_frozen_set
+
+// A frozen set file starts with this header. The keys of bin i are keys
+// starts[i] up to starts[i + 1].
+struct frozen_set_header {
+  char magic[8];
+  uint64_t size;
+  uint64_t used;
+  uint64_t key_size;
+  uint64_t starts_offset; // uint64_t starts[size + 1]
+  uint64_t keys_offset;   // KEY_TYPE keys[used]
+  uint64_t file_size;
+};
+
+// The last byte is the version of the format.
+#define FROZEN_SET_MAGIC "hset\0\0\0\1"
+
+static inline uint64_t
+frozen_set_align(uint64_t offset)
+{
+  size_t align = _Alignof(max_align_t);
+  return (offset + align - 1) / align * align;
+}
+
+#define GEN_FROZEN_STRUCTS(HASH_NAME, KEY_TYPE)                                \
+  FROZEN_SET(HASH_NAME)                                                        \
+  {                                                                            \
+    void *mapping;                                                             \
+    size_t mapping_size;                                                       \
+    size_t size;                                                               \
+    uint64_t const *starts;                                                    \
+    KEY_TYPE const *keys;                                                      \
+  };
+
+#define GEN_SAVE_TABLE(HASH_NAME, KEY_TYPE)                                    \
+  bool HASH_FN(HASH_NAME, save_table)(HTABLE(HASH_NAME) * table,               \
+                                      char const *path)                        \
+  {                                                                            \
+    struct frozen_set_header header = {                                        \
+        .magic = FROZEN_SET_MAGIC,                                             \
+        .size = table->size,                                                   \
+        .used = table->used,                                                   \
+        .key_size = sizeof(KEY_TYPE),                                          \
+        .starts_offset = frozen_set_align(sizeof header)};                     \
+    header.keys_offset = frozen_set_align(                                     \
+        header.starts_offset + (table->size + 1) * sizeof(uint64_t));          \
+    header.file_size = header.keys_offset + table->used * sizeof(KEY_TYPE);    \
+                                                                               \
+    FILE *file = fopen(path, "wb");                                            \
+    if (!file)                                                                 \
+      return false;                                                            \
+    fwrite(&header, sizeof header, 1, file);                                   \
+    fseek(file, header.starts_offset, SEEK_SET);                               \
+    uint64_t start = 0;                                                        \
+    for (BIN(HASH_NAME) *bin = table->bins; bin < table->bins + table->size;   \
+         bin++) {                                                              \
+      fwrite(&start, sizeof start, 1, file);                                   \
+      for (ITR(bin) itr = ITR_BEG(bin); !ITR_END(itr); itr = ITR_NEXT(itr)) {  \
+        start++;                                                               \
+      }                                                                        \
+    }                                                                          \
+    fwrite(&start, sizeof start, 1, file);                                     \
+    fseek(file, header.keys_offset, SEEK_SET);                                 \
+    for (BIN(HASH_NAME) *bin = table->bins; bin < table->bins + table->size;   \
+         bin++) {                                                              \
+      for (ITR(bin) itr = ITR_BEG(bin); !ITR_END(itr); itr = ITR_NEXT(itr)) {  \
+        KEY_TYPE key = HASH_FN(HASH_NAME, entry_key)(ITR_DEREF(itr)->key);     \
+        fwrite(&key, sizeof key, 1, file);                                     \
+      }                                                                        \
+    }                                                                          \
+    bool ok = !ferror(file) && start == table->used;                           \
+    return fclose(file) == 0 && ok;                                            \
+  }
+
+#define GEN_LOAD_FROZEN(HASH_NAME, KEY_TYPE)                                   \
+  FROZEN_SET(HASH_NAME) * HASH_FN(HASH_NAME, load_frozen)(char const *path)    \
+  {                                                                            \
+    int fd = open(path, O_RDONLY);                                             \
+    if (fd < 0)                                                                \
+      return NULL;                                                             \
+    struct stat st;                                                            \
+    uint64_t file_size = fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;       \
+    void *mapping = MAP_FAILED;                                                \
+    if (file_size >= sizeof(struct frozen_set_header))                         \
+      mapping = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);           \
+    close(fd); /* the mapping keeps the file open */                           \
+    if (mapping == MAP_FAILED)                                                 \
+      return NULL;                                                             \
+                                                                               \
+    struct frozen_set_header const *header = mapping;                          \
+    uint64_t size = header->size;                                              \
+    uint64_t const *starts =                                                   \
+        (uint64_t const *)((char *)mapping + header->starts_offset);           \
+    /* Written so the sums can't overflow, whatever the file says */           \
+    bool ok =                                                                  \
+        memcmp(header->magic, FROZEN_SET_MAGIC, sizeof header->magic) == 0 &&  \
+        header->file_size == file_size &&                                      \
+        header->key_size == sizeof(KEY_TYPE) && size >= MIN_SIZE &&            \
+        (size & (size - 1)) == 0 &&                                            \
+        header->starts_offset >= sizeof *header &&                             \
+        header->starts_offset % sizeof(uint64_t) == 0 &&                       \
+        header->starts_offset <= header->keys_offset &&                        \
+        size < (header->keys_offset - header->starts_offset) /                 \
+                   sizeof(uint64_t) &&                                         \
+        header->keys_offset <= file_size &&                                    \
+        header->keys_offset % _Alignof(KEY_TYPE) == 0 &&                       \
+        (file_size - header->keys_offset) % sizeof(KEY_TYPE) == 0 &&           \
+        header->used == (file_size - header->keys_offset) / sizeof(KEY_TYPE);  \
+    /* Each bin's keys must lie between its start and the next bin's */        \
+    ok = ok && starts[0] == 0 && starts[size] == header->used;                 \
+    for (uint64_t i = 0; ok && i < size; i++) {                                \
+      ok = starts[i] <= starts[i + 1];                                         \
+    }                                                                          \
+    if (!ok) {                                                                 \
+      munmap(mapping, file_size);                                              \
+      return NULL;                                                             \
+    }                                                                          \
+                                                                               \
+    FROZEN_SET(HASH_NAME) *set = malloc(sizeof *set);                          \
+    *set = (FROZEN_SET(HASH_NAME)){                                            \
+        .mapping = mapping,                                                    \
+        .mapping_size = file_size,                                             \
+        .size = size,                                                          \
+        .starts = starts,                                                      \
+        .keys = (KEY_TYPE const *)((char *)mapping + header->keys_offset)};    \
+    return set;                                                                \
+  }                                                                            \
+  void HASH_FN(HASH_NAME, free_frozen)(FROZEN_SET(HASH_NAME) * set)            \
+  {                                                                            \
+    munmap(set->mapping, set->mapping_size);                                   \
+    free(set);                                                                 \
+  }
+
+#define GEN_FROZEN_CONTAINS_KEY(HASH_NAME, KEY_TYPE, KEY_CMP, HASH)            \
+  bool HASH_FN(HASH_NAME, frozen_contains_key_with_hash)(                      \
+      FROZEN_SET(HASH_NAME) * set, uint64_t hash_key, KEY_TYPE key)            \
+  {                                                                            \
+    size_t bin = hash_key & (set->size - 1);                                   \
+    for (uint64_t i = set->starts[bin]; i < set->starts[bin + 1]; i++) {       \
+      if (KEY_CMP(set->keys[i], key))                                          \
+        return true;                                                           \
+    }                                                                          \
+    return false;                                                              \
+  }                                                                            \
+  bool HASH_FN(HASH_NAME, frozen_contains_key)(FROZEN_SET(HASH_NAME) * set,    \
+                                               KEY_TYPE key)                   \
+  {                                                                            \
+    return HASH_FN(HASH_NAME, frozen_contains_key_with_hash)(set, HASH(key),   \
+                                                             key);             \
+  }
+
+#define GEN_FROZEN_SET(HASH_NAME, KEY_TYPE, KEY_CMP, HASH)                     \
+  GEN_FROZEN_STRUCTS(HASH_NAME, KEY_TYPE)                                      \
+  GEN_SAVE_TABLE(HASH_NAME, KEY_TYPE)                                          \
+  GEN_LOAD_FROZEN(HASH_NAME, KEY_TYPE)                                         \
+  GEN_FROZEN_CONTAINS_KEY(HASH_NAME, KEY_TYPE, KEY_CMP, HASH)
+
+#endif
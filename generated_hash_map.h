@@ -0,0 +1,139 @@
+#ifndef GENERATED_HASH_MAP_H
+#define GENERATED_HASH_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "generated_hash_set.h"
+#include "generated_list.h"
+
+// A chained hash map, generated from the same macros as the sets in
+// generated_hash_set.h. The links hold entries with a key and a value, so
+// values are stored inline and never boxed, and the set functions, which
+// only look at the keys, work on the map as they are. lookup_key() gives us
+// a pointer to the value in the link, which stays valid until we delete the
+// key; resizing moves links but never copies them.
+//
+// The map owns its keys and values and frees them with the destructors.
+// Adding a key that is already there replaces both the key and the value.
+
+#define GEN_HASH_MAP_STRUCTS(HASH_NAME, KEY_TYPE, VAL_TYPE, KEY_CMP, HASH,     \
+                             KEY_DESTRUCTOR, VAL_DESTRUCTOR)                   \
+  struct HASH_NAME##_entry {                                                   \
+    KEY_TYPE key;                                                              \
+    VAL_TYPE value;                                                            \
+  };                                                                           \
+  static inline bool HASH_FN(HASH_NAME, entry_eq)(struct HASH_NAME##_entry a,  \
+                                                  struct HASH_NAME##_entry b)  \
+  {                                                                            \
+    return KEY_CMP(a.key, b.key);                                              \
+  }                                                                            \
+  static inline void HASH_FN(HASH_NAME,                                        \
+                             entry_free)(struct HASH_NAME##_entry entry)       \
+  {                                                                            \
+    KEY_DESTRUCTOR(entry.key);                                                 \
+    VAL_DESTRUCTOR(entry.value);                                               \
+  }                                                                            \
+  GEN_LIST(HASH_NAME##_bin, struct HASH_NAME##_entry,                          \
+           HASH_FN(HASH_NAME, entry_eq), HASH_FN(HASH_NAME, entry_free))       \
+  GEN_HTABLE_STRUCT(HASH_NAME)                                                 \
+  /* An entry to search for; only the key matters */                           \
+  static inline struct HASH_NAME##_entry HASH_FN(HASH_NAME, entry)(            \
+      uint64_t hash_key, KEY_TYPE key)                                         \
+  {                                                                            \
+    (void)hash_key; /* the entry doesn't keep it */                            \
+    return (struct HASH_NAME##_entry){.key = key};                             \
+  }                                                                            \
+  static inline uint64_t HASH_FN(HASH_NAME,                                    \
+                                 entry_hash)(struct HASH_NAME##_entry entry)   \
+  {                                                                            \
+    return HASH(entry.key);                                                    \
+  }                                                                            \
+  static inline KEY_TYPE HASH_FN(HASH_NAME,                                    \
+                                 entry_key)(struct HASH_NAME##_entry entry)    \
+  {                                                                            \
+    return entry.key;                                                          \
+  }
+
+#define GEN_MAP_FIND_LINK(HASH_NAME, KEY_TYPE, KEY_CMP)                        \
+  static inline struct HASH_NAME##_bin_link *HASH_FN(HASH_NAME, find_link)(    \
+      BIN(HASH_NAME) * bin, KEY_TYPE key)                                      \
+  {                                                                            \
+    for (ITR(bin) itr = ITR_BEG(bin); !ITR_END(itr); itr = ITR_NEXT(itr)) {    \
+      if (KEY_CMP(ITR_DEREF(itr)->key.key, key))                               \
+        return ITR_DEREF(itr);                                                 \
+    }                                                                          \
+    return NULL;                                                               \
+  }
+
+// The _with_hash functions take a key we have already hashed with HASH.
+#define GEN_ADD_MAP(HASH_NAME, KEY_TYPE, VAL_TYPE, HASH, KEY_DESTRUCTOR,       \
+                    VAL_DESTRUCTOR)                                            \
+  void HASH_FN(HASH_NAME, add_map_with_hash)(HTABLE(HASH_NAME) * table,        \
+                                             uint64_t hash_key, KEY_TYPE key,  \
+                                             VAL_TYPE value)                   \
+  {                                                                            \
+    HASH_SET_COUNT(table, finds);                                              \
+    BIN(HASH_NAME) *bin = HASH_FN(HASH_NAME, get_key_bin)(table, hash_key);    \
+    struct HASH_NAME##_bin_link *link =                                        \
+        HASH_FN(HASH_NAME, find_link)(bin, key);                               \
+    if (link) {                                                                \
+      KEY_DESTRUCTOR(link->key.key);                                           \
+      VAL_DESTRUCTOR(link->key.value);                                         \
+      link->key = (struct HASH_NAME##_entry){.key = key, .value = value};      \
+      return;                                                                  \
+    }                                                                          \
+    LIST_FN(HASH_NAME, add_key_pool)(                                          \
+        bin, table->pool,                                                      \
+        (struct HASH_NAME##_entry){.key = key, .value = value});               \
+    table->used++;                                                             \
+    if (table->size == table->used) {                                          \
+      HASH_FN(HASH_NAME, resize)(table, 2 * table->size);                      \
+    }                                                                          \
+  }                                                                            \
+  void HASH_FN(HASH_NAME, add_map)(HTABLE(HASH_NAME) * table, KEY_TYPE key,    \
+                                   VAL_TYPE value)                             \
+  {                                                                            \
+    HASH_FN(HASH_NAME, add_map_with_hash)(table, HASH(key), key, value);       \
+  }
+
+#define GEN_LOOKUP_KEY(HASH_NAME, KEY_TYPE, VAL_TYPE, HASH)                    \
+  VAL_TYPE *HASH_FN(HASH_NAME, lookup_key_with_hash)(                          \
+      HTABLE(HASH_NAME) * table, uint64_t hash_key, KEY_TYPE key)              \
+  {                                                                            \
+    HASH_SET_COUNT(table, finds);                                              \
+    BIN(HASH_NAME) *bin = HASH_FN(HASH_NAME, get_key_bin)(table, hash_key);    \
+    struct HASH_NAME##_bin_link *link =                                        \
+        HASH_FN(HASH_NAME, find_link)(bin, key);                               \
+    return link ? &link->key.value : NULL;                                     \
+  }                                                                            \
+  VAL_TYPE *HASH_FN(HASH_NAME, lookup_key)(HTABLE(HASH_NAME) * table,          \
+                                           KEY_TYPE key)                       \
+  {                                                                            \
+    return HASH_FN(HASH_NAME, lookup_key_with_hash)(table, HASH(key), key);    \
+  }
+
+// Besides add_map() and lookup_key(), the map has new_table(),
+// new_pooled_table(), free_table(), contains_key(), contains_keys(),
+// delete_key(), their _with_hash versions, and table_stats(), as the sets do.
+#define GEN_HASH_MAP(HASH_NAME, KEY_TYPE, VAL_TYPE, KEY_CMP, HASH,             \
+                     KEY_DESTRUCTOR, VAL_DESTRUCTOR)                           \
+  GEN_HASH_MAP_STRUCTS(HASH_NAME, KEY_TYPE, VAL_TYPE, KEY_CMP, HASH,           \
+                       KEY_DESTRUCTOR, VAL_DESTRUCTOR)                         \
+  GEN_GET_KEY_BIN(HASH_NAME)                                                   \
+  GEN_NEW_TABLE(HASH_NAME)                                                     \
+  GEN_NEW_POOLED_TABLE(HASH_NAME)                                              \
+  GEN_FREE_TABLE(HASH_NAME)                                                    \
+  GEN_RESIZE(HASH_NAME)                                                        \
+  GEN_MAP_FIND_LINK(HASH_NAME, KEY_TYPE, KEY_CMP)                              \
+  GEN_ADD_MAP(HASH_NAME, KEY_TYPE, VAL_TYPE, HASH, KEY_DESTRUCTOR,             \
+              VAL_DESTRUCTOR)                                                  \
+  GEN_LOOKUP_KEY(HASH_NAME, KEY_TYPE, VAL_TYPE, HASH)                          \
+  GEN_CONTAINS_KEY(HASH_NAME, KEY_TYPE, HASH)                                  \
+  GEN_CONTAINS_KEYS(HASH_NAME, KEY_TYPE, HASH)                                 \
+  GEN_DELETE_KEY(HASH_NAME, KEY_TYPE, HASH, 1)                                 \
+  GEN_TABLE_STATS(HASH_NAME)
+
+#endif
@@ -0,0 +1,123 @@
+#define HASH_SET_STATS // so we can test the counters
+#include "generated_hash_map.h"
+#include "hash.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char *
+itoa(unsigned int i)
+{
+  // Not super safe itoa, but good enough for an example like this.
+  char *buf = malloc(sizeof(char) * 20);
+  sprintf(buf, "%d", i);
+  return buf;
+}
+
+// comparison and dummy destructor for int keys
+#define EQ_CMP(A, B) ((A) == (B))
+#define NOP_DESTRUCTOR(KEY)
+
+GEN_HASH_MAP(integer, uint32_t, uint32_t, EQ_CMP, hash_u32, NOP_DESTRUCTOR,
+             NOP_DESTRUCTOR);
+
+static void
+test_int_map(int no_elms)
+{
+  struct integer_hash_table *map = integer_new_table();
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    integer_add_map(map, i, 2 * i);
+  }
+  assert(map->used == no_elms);
+  for (uint32_t i = 0; i < 2 * no_elms; ++i) {
+    uint32_t *val = integer_lookup_key(map, i);
+    assert(i < no_elms ? *val == 2 * i : !val);
+    assert(integer_contains_key(map, i) == (i < no_elms));
+  }
+
+  // Replace the values of the even keys, through add_map() and through the
+  // pointers lookup_key() gives us, and delete the odd keys.
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    if (i % 4 == 0)
+      integer_add_map(map, i, i);
+    else if (i % 4 == 2)
+      *integer_lookup_key(map, i) = i;
+    else
+      integer_delete_key(map, i);
+  }
+  assert(map->used == (no_elms + 1) / 2);
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    uint32_t *val = integer_lookup_key(map, i);
+    assert(i % 2 ? !val : *val == i);
+  }
+  integer_free_table(map);
+}
+
+// Values stay where they are when the table resizes.
+static void
+test_pooled_map(int no_elms)
+{
+  struct integer_hash_table *map = integer_new_pooled_table();
+  integer_add_map(map, 0, 42);
+  uint32_t *val = integer_lookup_key(map, 0);
+  for (uint32_t i = 1; i < no_elms; ++i) {
+    integer_add_map_with_hash(map, hash_u32(i), i, i);
+  }
+  assert(no_elms < MIN_SIZE || map->counters.resizes > 0);
+  assert(val == integer_lookup_key_with_hash(map, hash_u32(0), 0));
+  assert(*val == 42);
+  for (uint32_t i = 1; i < no_elms; ++i) {
+    integer_delete_key(map, i);
+  }
+  assert(val == integer_lookup_key(map, 0));
+  integer_free_table(map);
+}
+
+#define STR_EQ(A, B) (strcmp(A, B) == 0)
+GEN_HASH_MAP(str2str, char *, char *, STR_EQ, hash_str, free, free);
+
+// The map frees the keys and values it replaces, deletes, and holds when we
+// free it.
+static void
+test_string_map(int no_elms)
+{
+  struct str2str_hash_table *map = str2str_new_table();
+  for (unsigned int i = 0; i < no_elms; ++i) {
+    str2str_add_map(map, itoa(i), itoa(i + 1));
+  }
+  for (unsigned int i = 0; i < no_elms; i += 2) {
+    str2str_add_map(map, itoa(i), itoa(i));
+  }
+  for (unsigned int i = 0; i < no_elms; ++i) {
+    char *key = itoa(i);
+    char **val = str2str_lookup_key(map, key);
+    assert(val && atoi(*val) == (i % 2 ? i + 1 : i));
+    if (i % 3 == 0)
+      str2str_delete_key(map, key);
+    free(key);
+  }
+  for (unsigned int i = 0; i < no_elms; ++i) {
+    char *key = itoa(i);
+    assert(!str2str_lookup_key(map, key) == (i % 3 == 0));
+    free(key);
+  }
+  str2str_free_table(map);
+}
+
+int
+main(int argc, const char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: %s no_elements\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  int no_elms = atoi(argv[1]);
+  test_int_map(no_elms);
+  test_pooled_map(no_elms);
+  test_string_map(no_elms);
+
+  return EXIT_SUCCESS;
+}
@@ -3,7 +3,10 @@
 #define CHAINED_HASH_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "generated_list.h"
 
@@ -14,21 +17,115 @@
 
 #define MIN_SIZE 8
 
-#define GEN_HASH_STRUCTS(HASH_NAME, KEY_TYPE, KEY_CMP, KEY_DESTRUCTOR)         \
-  GEN_LIST(HASH_NAME##_bin, KEY_TYPE, KEY_CMP, KEY_DESTRUCTOR)                 \
+// Counters for the table_stats functions. Counting lookups costs a little on
+// every operation, so it is only done if HASH_SET_STATS is defined before
+// this header is first included; otherwise finds stays zero. The choice is
+// made once, for every table the translation unit generates, and defining it
+// later has no effect.
+struct hash_set_counters {
+  unsigned long finds; // insert, contains and delete calls (HASH_SET_STATS)
+  unsigned long resizes;
+  double resize_seconds; // time spent moving links to resized bins
+};
+
+#ifdef HASH_SET_STATS
+#define HASH_SET_COUNT(TABLE, COUNTER) ((TABLE)->counters.COUNTER++)
+#else
+#define HASH_SET_COUNT(TABLE, COUNTER) ((void)0)
+#endif
+
+static inline double
+hash_set_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The bins hold lists of entries. An entry is just the key, unless we cache
+// hash keys, and the table code gets at the parts of an entry through
+// NAME_entry(), NAME_entry_hash() and NAME_entry_key().
+#define GEN_HTABLE_STRUCT(HASH_NAME)                                           \
   HTABLE(HASH_NAME)                                                            \
   {                                                                            \
     BIN(HASH_NAME) * bins;                                                     \
-    unsigned int size;                                                         \
-    unsigned int used;                                                         \
+    size_t size;                                                               \
+    size_t used;                                                               \
+    struct hash_set_counters counters;                                         \
+    struct link_pool *pool; /* links for the bins, or NULL for malloc() */     \
   };
 
+// The list and table for plain keys. GEN_HASH_TABLE adds the entry functions
+// with GEN_KEY_ENTRIES, since they need HASH.
+#define GEN_HASH_STRUCTS(HASH_NAME, KEY_TYPE, KEY_CMP, KEY_DESTRUCTOR)         \
+  GEN_LIST(HASH_NAME##_bin, KEY_TYPE, KEY_CMP, KEY_DESTRUCTOR)                 \
+  GEN_HTABLE_STRUCT(HASH_NAME)
+
+// Bins that are unrolled lists, with several keys in each link
+#define GEN_UNROLLED_HASH_STRUCTS(HASH_NAME, KEY_TYPE, KEY_CMP, HASH,          \
+                                  KEY_DESTRUCTOR)                              \
+  GEN_UNROLLED_LIST(HASH_NAME##_bin, KEY_TYPE, KEY_CMP, KEY_DESTRUCTOR)        \
+  GEN_HTABLE_STRUCT(HASH_NAME)                                                 \
+  GEN_KEY_ENTRIES(HASH_NAME, KEY_TYPE, HASH)
+
+#define GEN_KEY_ENTRIES(HASH_NAME, KEY_TYPE, HASH)                             \
+  static inline KEY_TYPE HASH_FN(HASH_NAME, entry)(uint64_t hash_key,          \
+                                                   KEY_TYPE key)               \
+  {                                                                            \
+    (void)hash_key; /* the entry is just the key */                            \
+    return key;                                                                \
+  }                                                                            \
+  static inline uint64_t HASH_FN(HASH_NAME, entry_hash)(KEY_TYPE entry)        \
+  {                                                                            \
+    return HASH(entry);                                                        \
+  }                                                                            \
+  static inline KEY_TYPE HASH_FN(HASH_NAME, entry_key)(KEY_TYPE entry)         \
+  {                                                                            \
+    return entry;                                                              \
+  }
+
+// With cached hash keys, each link also holds its key's hash key. Resizing
+// doesn't call HASH, and we only compare keys whose hash keys are equal.
+#define GEN_CACHED_HASH_STRUCTS(HASH_NAME, KEY_TYPE, KEY_CMP, KEY_DESTRUCTOR)  \
+  struct HASH_NAME##_entry {                                                   \
+    uint64_t hash_key;                                                         \
+    KEY_TYPE key;                                                              \
+  };                                                                           \
+  static inline bool HASH_FN(HASH_NAME, entry_eq)(struct HASH_NAME##_entry a,  \
+                                                  struct HASH_NAME##_entry b)  \
+  {                                                                            \
+    return a.hash_key == b.hash_key && KEY_CMP(a.key, b.key);                  \
+  }                                                                            \
+  static inline void HASH_FN(HASH_NAME,                                        \
+                             entry_free)(struct HASH_NAME##_entry entry)       \
+  {                                                                            \
+    KEY_DESTRUCTOR(entry.key);                                                 \
+  }                                                                            \
+  GEN_LIST(HASH_NAME##_bin, struct HASH_NAME##_entry,                          \
+           HASH_FN(HASH_NAME, entry_eq), HASH_FN(HASH_NAME, entry_free))       \
+  GEN_HTABLE_STRUCT(HASH_NAME)                                                 \
+  static inline struct HASH_NAME##_entry HASH_FN(HASH_NAME, entry)(            \
+      uint64_t hash_key, KEY_TYPE key)                                         \
+  {                                                                            \
+    return (struct HASH_NAME##_entry){.hash_key = hash_key, .key = key};       \
+  }                                                                            \
+  static inline uint64_t HASH_FN(HASH_NAME,                                    \
+                                 entry_hash)(struct HASH_NAME##_entry entry)   \
+  {                                                                            \
+    return entry.hash_key;                                                     \
+  }                                                                            \
+  static inline KEY_TYPE HASH_FN(HASH_NAME,                                    \
+                                 entry_key)(struct HASH_NAME##_entry entry)    \
+  {                                                                            \
+    return entry.key;                                                          \
+  }
+
 #define GEN_GET_KEY_BIN(HASH_NAME)                                             \
   BIN(HASH_NAME) * HASH_FN(HASH_NAME, get_key_bin)(HTABLE(HASH_NAME) * table,  \
-                                                   unsigned int hash_key)      \
+                                                   uint64_t hash_key)          \
   {                                                                            \
-    unsigned int mask = table->size - 1;                                       \
-    unsigned int index = hash_key & mask;                                      \
+    size_t mask = table->size - 1;                                             \
+    size_t index = hash_key & mask;                                            \
     return &table->bins[index];                                                \
   }
 
@@ -37,7 +134,8 @@
   {                                                                            \
     HTABLE(HASH_NAME) *table = malloc(sizeof *table);                          \
     BIN(HASH_NAME) *bins = malloc(MIN_SIZE * sizeof *bins);                    \
-    *table = (HTABLE(HASH_NAME)){.bins = bins, .size = MIN_SIZE, .used = 0};   \
+    *table = (HTABLE(HASH_NAME)){                                              \
+        .bins = bins, .size = MIN_SIZE, .used = 0, .counters = {0}};           \
     for (BIN(HASH_NAME) *bin = table->bins; bin < table->bins + table->size;   \
          bin++) {                                                              \
       bin->head = NULL;                                                        \
@@ -45,49 +143,126 @@
     return table;                                                              \
   }
 
+// A table that allocates its links from its own pool. Inserting and deleting
+// reuse freed links instead of calling malloc() and free(), and freeing the
+// table frees the links a slab at a time.
+#define GEN_NEW_POOLED_TABLE(HASH_NAME)                                        \
+  HTABLE(HASH_NAME) * HASH_FN(HASH_NAME, new_pooled_table)()                   \
+  {                                                                            \
+    HTABLE(HASH_NAME) *table = HASH_FN(HASH_NAME, new_table)();                \
+    table->pool = malloc(sizeof *table->pool);                                 \
+    *table->pool =                                                             \
+        (struct link_pool)NEW_LINK_POOL(struct HASH_NAME##_bin_link);          \
+    return table;                                                              \
+  }
+
 #define GEN_FREE_TABLE(HASH_NAME)                                              \
   void HASH_FN(HASH_NAME, free_table)(HTABLE(HASH_NAME) * table)               \
   {                                                                            \
     for (BIN(HASH_NAME) *bin = table->bins; bin < table->bins + table->size;   \
          bin++) {                                                              \
-      LIST_FN(HASH_NAME, free_list)(bin);                                      \
+      LIST_FN(HASH_NAME, free_list_pool)(bin, table->pool);                    \
+    }                                                                          \
+    if (table->pool) {                                                         \
+      link_pool_release(table->pool);                                          \
+      free(table->pool);                                                       \
     }                                                                          \
     free(table->bins);                                                         \
     free(table);                                                               \
   }
 
-#define GEN_INSERT_KEY(HASH_NAME, KEY_TYPE, HASH)                              \
-  void HASH_FN(HASH_NAME, insert_key)(HTABLE(HASH_NAME) * table, KEY_TYPE key) \
+// The _with_hash functions take a key we have already hashed with HASH, so
+// a key can be hashed once and then used with several tables. Tables grow
+// when they hold MAX_LOAD keys per bin, and shrink when they hold fewer than
+// a quarter of that.
+#define GEN_INSERT_KEY(HASH_NAME, KEY_TYPE, HASH, MAX_LOAD)                    \
+  void HASH_FN(HASH_NAME, insert_key_with_hash)(HTABLE(HASH_NAME) * table,     \
+                                                uint64_t hash_key,             \
+                                                KEY_TYPE key)                  \
   {                                                                            \
-    BIN(HASH_NAME) *bin = HASH_FN(HASH_NAME, get_key_bin)(table, HASH(key));   \
-    if (!LIST_FN(HASH_NAME, contains_key)(bin, key)) {                         \
-      LIST_FN(HASH_NAME, add_key)(bin, key);                                   \
+    HASH_SET_COUNT(table, finds);                                              \
+    BIN(HASH_NAME) *bin = HASH_FN(HASH_NAME, get_key_bin)(table, hash_key);    \
+    __auto_type entry = HASH_FN(HASH_NAME, entry)(hash_key, key);              \
+    if (!LIST_FN(HASH_NAME, contains_key)(bin, entry)) {                       \
+      LIST_FN(HASH_NAME, add_key_pool)(bin, table->pool, entry);               \
       table->used++;                                                           \
-      if (table->size == table->used) {                                        \
+      if (table->used == MAX_LOAD * table->size) {                             \
         HASH_FN(HASH_NAME, resize)(table, 2 * table->size);                    \
       }                                                                        \
     }                                                                          \
+  }                                                                            \
+  void HASH_FN(HASH_NAME, insert_key)(HTABLE(HASH_NAME) * table, KEY_TYPE key) \
+  {                                                                            \
+    HASH_FN(HASH_NAME, insert_key_with_hash)(table, HASH(key), key);           \
   }
 
 #define GEN_CONTAINS_KEY(HASH_NAME, KEY_TYPE, HASH)                            \
+  bool HASH_FN(HASH_NAME, contains_key_with_hash)(HTABLE(HASH_NAME) * table,   \
+                                                  uint64_t hash_key,           \
+                                                  KEY_TYPE key)                \
+  {                                                                            \
+    HASH_SET_COUNT(table, finds);                                              \
+    BIN(HASH_NAME) *bin = HASH_FN(HASH_NAME, get_key_bin)(table, hash_key);    \
+    return LIST_FN(HASH_NAME, contains_key)(                                   \
+        bin, HASH_FN(HASH_NAME, entry)(hash_key, key));                        \
+  }                                                                            \
   bool HASH_FN(HASH_NAME, contains_key)(HTABLE(HASH_NAME) * table,             \
                                         KEY_TYPE key)                          \
   {                                                                            \
-    BIN(HASH_NAME) *bin = HASH_FN(HASH_NAME, get_key_bin)(table, HASH(key));   \
-    return LIST_FN(HASH_NAME, contains_key)(bin, key);                         \
+    return HASH_FN(HASH_NAME, contains_key_with_hash)(table, HASH(key), key);  \
   }
 
-#define GEN_DELETE_KEY(HASH_NAME, KEY_TYPE, HASH)                              \
-  void HASH_FN(HASH_NAME, delete_key)(HTABLE(HASH_NAME) * table, KEY_TYPE key) \
+#define GEN_DELETE_KEY(HASH_NAME, KEY_TYPE, HASH, MAX_LOAD)                    \
+  void HASH_FN(HASH_NAME, delete_key_with_hash)(HTABLE(HASH_NAME) * table,     \
+                                                uint64_t hash_key,             \
+                                                KEY_TYPE key)                  \
   {                                                                            \
-    BIN(HASH_NAME) *bin = HASH_FN(HASH_NAME, get_key_bin)(table, HASH(key));   \
-    if (LIST_FN(HASH_NAME, contains_key)(bin, key)) {                          \
-      LIST_FN(HASH_NAME, delete_key)(bin, key);                                \
+    HASH_SET_COUNT(table, finds);                                              \
+    BIN(HASH_NAME) *bin = HASH_FN(HASH_NAME, get_key_bin)(table, hash_key);    \
+    __auto_type entry = HASH_FN(HASH_NAME, entry)(hash_key, key);              \
+    if (LIST_FN(HASH_NAME, contains_key)(bin, entry)) {                        \
+      LIST_FN(HASH_NAME, delete_key_pool)(bin, table->pool, entry);            \
       table->used--;                                                           \
-      if (table->size > MIN_SIZE && table->used < table->size / 4) {           \
+      if (table->size > MIN_SIZE &&                                            \
+          table->used < MAX_LOAD * table->size / 4) {                          \
         HASH_FN(HASH_NAME, resize)(table, table->size / 2);                    \
       }                                                                        \
     }                                                                          \
+  }                                                                            \
+  void HASH_FN(HASH_NAME, delete_key)(HTABLE(HASH_NAME) * table, KEY_TYPE key) \
+  {                                                                            \
+    HASH_FN(HASH_NAME, delete_key_with_hash)(table, HASH(key), key);           \
+  }
+
+// The number of keys we hash, and prefetch bins for, before we search them.
+#define PREFETCH_BATCH 16
+
+// Checking keys a batch at a time lets us have the bins, and then the first
+// links, for all of them on the way into the cache at the same time.
+#define GEN_CONTAINS_KEYS(HASH_NAME, KEY_TYPE, HASH)                           \
+  void HASH_FN(HASH_NAME, contains_keys)(HTABLE(HASH_NAME) * table,            \
+                                         KEY_TYPE const *keys, size_t n,       \
+                                         bool *contains)                       \
+  {                                                                            \
+    BIN(HASH_NAME) *bins[PREFETCH_BATCH];                                      \
+    uint64_t hash_keys[PREFETCH_BATCH];                                        \
+    for (size_t batch = 0; batch < n; batch += PREFETCH_BATCH) {               \
+      size_t m = n - batch < PREFETCH_BATCH ? n - batch : PREFETCH_BATCH;      \
+      KEY_TYPE const *batch_keys = keys + batch;                               \
+      for (size_t i = 0; i < m; i++) {                                         \
+        HASH_SET_COUNT(table, finds);                                          \
+        hash_keys[i] = HASH(batch_keys[i]);                                    \
+        bins[i] = HASH_FN(HASH_NAME, get_key_bin)(table, hash_keys[i]);        \
+        __builtin_prefetch(bins[i]);                                           \
+      }                                                                        \
+      for (size_t i = 0; i < m; i++) {                                         \
+        __builtin_prefetch(bins[i]->head);                                     \
+      }                                                                        \
+      for (size_t i = 0; i < m; i++) {                                         \
+        contains[batch + i] = LIST_FN(HASH_NAME, contains_key)(                \
+            bins[i], HASH_FN(HASH_NAME, entry)(hash_keys[i], batch_keys[i]));  \
+      }                                                                        \
+    }                                                                          \
   }
 
 #define MOVE_LINK(FROM, TO)                                                    \
@@ -98,10 +273,11 @@
     *TO = link;                                                                \
   } while (0)
 
-#define GEN_RESIZE(HASH_NAME, HASH)                                            \
+#define GEN_RESIZE(HASH_NAME)                                                  \
   void HASH_FN(HASH_NAME, resize)(HTABLE(HASH_NAME) * table,                   \
-                                  unsigned int new_size)                       \
+                                  size_t new_size)                             \
   {                                                                            \
+    double start = hash_set_seconds();                                         \
     BIN(HASH_NAME) *old_bins = table->bins, *old_from = old_bins,              \
                    *old_to = old_from + table->size;                           \
                                                                                \
@@ -114,23 +290,128 @@
                                                                                \
     for (BIN(HASH_NAME) *bin = old_from; bin < old_to; bin++) {                \
       for (ITR(bin) itr = ITR_BEG(bin); !ITR_END(itr);) {                      \
-        unsigned int hash_key = HASH(ITR_DEREF(itr)->key);                     \
+        uint64_t hash_key =                                                    \
+            HASH_FN(HASH_NAME, entry_hash)(ITR_DEREF(itr)->key);               \
         MOVE_LINK(itr,                                                         \
                   ITR_BEG(HASH_FN(HASH_NAME, get_key_bin)(table, hash_key)));  \
       }                                                                        \
     }                                                                          \
                                                                                \
     free(old_bins);                                                            \
+    table->counters.resizes++;                                                 \
+    table->counters.resize_seconds += hash_set_seconds() - start;              \
+  }
+
+// With unrolled lists we can't move links, since the keys in a link go to
+// different bins. We move the keys instead, and give the old links back to
+// the pool as we empty them, so we can reuse them for the new bins.
+#define GEN_UNROLLED_RESIZE(HASH_NAME)                                         \
+  void HASH_FN(HASH_NAME, resize)(HTABLE(HASH_NAME) * table,                   \
+                                  size_t new_size)                             \
+  {                                                                            \
+    double start = hash_set_seconds();                                         \
+    BIN(HASH_NAME) *old_bins = table->bins, *old_from = old_bins,              \
+                   *old_to = old_from + table->size;                           \
+                                                                               \
+    table->bins = malloc(new_size * sizeof *table->bins);                      \
+    table->size = new_size;                                                    \
+    for (BIN(HASH_NAME) *bin = table->bins; bin < table->bins + table->size;   \
+         bin++) {                                                              \
+      bin->head = NULL;                                                        \
+    }                                                                          \
+                                                                               \
+    for (BIN(HASH_NAME) *bin = old_from; bin < old_to; bin++) {                \
+      for (ITR(bin) itr = ITR_BEG(bin); !ITR_END(itr);) {                      \
+        for (unsigned int i = 0; i < ITR_DEREF(itr)->count; i++) {             \
+          __auto_type key = ITR_DEREF(itr)->keys[i];                           \
+          uint64_t hash_key = HASH_FN(HASH_NAME, entry_hash)(key);             \
+          LIST_FN(HASH_NAME, add_key_pool)(                                    \
+              HASH_FN(HASH_NAME, get_key_bin)(table, hash_key), table->pool,   \
+              key);                                                            \
+        }                                                                      \
+        DELETE_POOL_LINK(itr, table->pool);                                    \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    free(old_bins);                                                            \
+    table->counters.resizes++;                                                 \
+    table->counters.resize_seconds += hash_set_seconds() - start;              \
   }
 
+// Chain lengths are the number of keys in a bin, so chain_lengths[0] counts
+// the empty bins. The last bucket also holds the longer chains.
+#define HASH_SET_STATS_BUCKETS 16
+struct hash_set_stats {
+  size_t size;
+  size_t used;
+  double load_factor; // used / size
+  size_t chain_lengths[HASH_SET_STATS_BUCKETS];
+  size_t max_chain_length;
+  struct hash_set_counters counters;
+};
+
+// Walks all the chains, so it isn't something to do on every operation.
+#define GEN_TABLE_STATS(HASH_NAME)                                             \
+  void HASH_FN(HASH_NAME, table_stats)(HTABLE(HASH_NAME) * table,              \
+                                       struct hash_set_stats *stats)           \
+  {                                                                            \
+    *stats = (struct hash_set_stats){.size = table->size,                      \
+                                     .used = table->used,                      \
+                                     .counters = table->counters};             \
+    stats->load_factor = (double)table->used / table->size;                    \
+    for (BIN(HASH_NAME) *bin = table->bins; bin < table->bins + table->size;   \
+         bin++) {                                                              \
+      size_t length = LIST_FN(HASH_NAME, length)(bin);                         \
+      size_t bucket = length < HASH_SET_STATS_BUCKETS                          \
+                          ? length                                             \
+                          : HASH_SET_STATS_BUCKETS - 1;                        \
+      stats->chain_lengths[bucket]++;                                          \
+      if (length > stats->max_chain_length)                                    \
+        stats->max_chain_length = length;                                      \
+    }                                                                          \
+  }
+
+#define GEN_HASH_FUNCTIONS(HASH_NAME, KEY_TYPE, HASH)                          \
+  GEN_GET_KEY_BIN(HASH_NAME)                                                   \
+  GEN_NEW_TABLE(HASH_NAME)                                                     \
+  GEN_NEW_POOLED_TABLE(HASH_NAME)                                              \
+  GEN_FREE_TABLE(HASH_NAME)                                                    \
+  GEN_RESIZE(HASH_NAME)                                                        \
+  GEN_INSERT_KEY(HASH_NAME, KEY_TYPE, HASH, 1)                                 \
+  GEN_CONTAINS_KEY(HASH_NAME, KEY_TYPE, HASH)                                  \
+  GEN_CONTAINS_KEYS(HASH_NAME, KEY_TYPE, HASH)                                 \
+  GEN_DELETE_KEY(HASH_NAME, KEY_TYPE, HASH, 1)                                 \
+  GEN_TABLE_STATS(HASH_NAME)
+
 #define GEN_HASH_TABLE(HASH_NAME, KEY_TYPE, KEY_CMP, HASH, KEY_DESTRUCTOR)     \
   GEN_HASH_STRUCTS(HASH_NAME, KEY_TYPE, KEY_CMP, KEY_DESTRUCTOR)               \
+  GEN_KEY_ENTRIES(HASH_NAME, KEY_TYPE, HASH)                                   \
+  GEN_HASH_FUNCTIONS(HASH_NAME, KEY_TYPE, HASH)
+
+// The same table, with a hash key cached in every link. It costs eight bytes
+// a link but pays off when HASH or KEY_CMP are expensive, as for strings.
+#define GEN_CACHED_HASH_TABLE(HASH_NAME, KEY_TYPE, KEY_CMP, HASH,              \
+                              KEY_DESTRUCTOR)                                  \
+  GEN_CACHED_HASH_STRUCTS(HASH_NAME, KEY_TYPE, KEY_CMP, KEY_DESTRUCTOR)        \
+  GEN_HASH_FUNCTIONS(HASH_NAME, KEY_TYPE, HASH)
+
+// The same table, with unrolled lists in the bins. A link holds a cache line
+// of keys, so the table can run at a higher load factor, with fewer bins and
+// links, and most chains still fit in one link.
+#define UNROLLED_MAX_LOAD 4
+#define GEN_UNROLLED_HASH_TABLE(HASH_NAME, KEY_TYPE, KEY_CMP, HASH,            \
+                                KEY_DESTRUCTOR)                                \
+  GEN_UNROLLED_HASH_STRUCTS(HASH_NAME, KEY_TYPE, KEY_CMP, HASH,                \
+                            KEY_DESTRUCTOR)                                    \
   GEN_GET_KEY_BIN(HASH_NAME)                                                   \
   GEN_NEW_TABLE(HASH_NAME)                                                     \
+  GEN_NEW_POOLED_TABLE(HASH_NAME)                                              \
   GEN_FREE_TABLE(HASH_NAME)                                                    \
-  GEN_RESIZE(HASH_NAME, HASH)                                                  \
-  GEN_INSERT_KEY(HASH_NAME, KEY_TYPE, HASH)                                    \
+  GEN_UNROLLED_RESIZE(HASH_NAME)                                               \
+  GEN_INSERT_KEY(HASH_NAME, KEY_TYPE, HASH, UNROLLED_MAX_LOAD)                 \
   GEN_CONTAINS_KEY(HASH_NAME, KEY_TYPE, HASH)                                  \
-  GEN_DELETE_KEY(HASH_NAME, KEY_TYPE, HASH)
+  GEN_CONTAINS_KEYS(HASH_NAME, KEY_TYPE, HASH)                                 \
+  GEN_DELETE_KEY(HASH_NAME, KEY_TYPE, HASH, UNROLLED_MAX_LOAD)                 \
+  GEN_TABLE_STATS(HASH_NAME)
 
 #endif
@@ -1,5 +1,8 @@
 
+#define HASH_SET_STATS // so we can test the counters
+#include "generated_frozen_set.h"
 #include "generated_hash_set.h"
+#include "hash.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -38,12 +41,14 @@ random_string_key()
   return itoa(key);
 }
 
-// comparison, (dummy) hash function, and dummy destructor for int keys
+// comparison and dummy destructor for int keys
 #define EQ_CMP(A, B) ((A) == (B))
-#define HASH(KEY) ((KEY) ^ (0xdeadbeef))
 #define NOP_DESTRUCTOR(KEY)
 
-GEN_HASH_TABLE(integer, unsigned int, EQ_CMP, HASH, NOP_DESTRUCTOR);
+GEN_HASH_TABLE(integer, unsigned int, EQ_CMP, hash_u32, NOP_DESTRUCTOR);
+GEN_FROZEN_SET(integer, unsigned int, EQ_CMP, hash_u32);
+GEN_UNROLLED_HASH_TABLE(unrolled, unsigned int, EQ_CMP, hash_u32,
+                        NOP_DESTRUCTOR);
 
 void
 test_int_table(int no_elms)
@@ -67,6 +72,25 @@ test_int_table(int no_elms)
   for (int i = 0; i < no_elms; ++i) {
     assert(integer_contains_key(table, keys[i]));
   }
+  bool *contains = malloc(no_elms * sizeof *contains);
+  integer_contains_keys(table, keys, no_elms, contains);
+  for (int i = 0; i < no_elms; ++i) {
+    assert(contains[i]);
+  }
+
+  struct hash_set_stats stats;
+  integer_table_stats(table, &stats);
+  assert(stats.size == table->size && stats.used == table->used);
+  unsigned int bins = 0, chained_keys = 0;
+  for (unsigned int i = 0; i < HASH_SET_STATS_BUCKETS; ++i) {
+    bins += stats.chain_lengths[i];
+    chained_keys += i * stats.chain_lengths[i];
+  }
+  assert(bins == stats.size);
+  assert(stats.max_chain_length >= HASH_SET_STATS_BUCKETS ||
+         chained_keys == stats.used);
+  assert(stats.counters.finds >= 3 * no_elms);
+  assert(stats.counters.resizes > 0 || stats.size == MIN_SIZE);
 
   printf("Deleting all elements.\n");
   for (int i = 0; i < no_elms; ++i) {
@@ -80,11 +104,16 @@ test_int_table(int no_elms)
   for (int i = 0; i < no_elms; ++i) {
     assert(!integer_contains_key(table, keys[i]));
   }
+  integer_contains_keys(table, keys, no_elms, contains);
+  for (int i = 0; i < no_elms; ++i) {
+    assert(!contains[i]);
+  }
 
   clock_t end = clock();
   double elapsed_time = (end - start) / (double)CLOCKS_PER_SEC;
   printf("%g\n", elapsed_time);
 
+  free(contains);
   free(keys);
   integer_free_table(table);
 }
@@ -92,16 +121,8 @@ test_int_table(int no_elms)
 // String table (where the table takes ownership and frees elements
 // through the generated list code).
 #define STR_EQ(A, B) (strcmp(A, B) == 0)
-unsigned int
-u32_hash(char *x)
-{
-  unsigned int h = 0;
-  for (char *p = x; *p; p++) {
-    h = 31 * h + *p;
-  }
-  return h;
-}
-GEN_HASH_TABLE(string, char *, STR_EQ, u32_hash, free);
+GEN_HASH_TABLE(string, char *, STR_EQ, hash_str, free);
+GEN_CACHED_HASH_TABLE(cached_string, char *, STR_EQ, hash_str, free);
 
 void
 test_string_table(int no_elms)
@@ -126,6 +147,11 @@ test_string_table(int no_elms)
   for (int i = 0; i < no_elms; ++i) {
     assert(string_contains_key(table, keys[i]));
   }
+  bool *contains = malloc(no_elms * sizeof *contains);
+  string_contains_keys(table, keys, no_elms, contains);
+  for (int i = 0; i < no_elms; ++i) {
+    assert(contains[i]);
+  }
 
   printf("Deleting all elements.\n");
   for (int i = 0; i < no_elms; ++i) {
@@ -139,6 +165,10 @@ test_string_table(int no_elms)
   for (int i = 0; i < no_elms; ++i) {
     assert(!string_contains_key(table, keys[i]));
   }
+  string_contains_keys(table, keys, no_elms, contains);
+  for (int i = 0; i < no_elms; ++i) {
+    assert(!contains[i]);
+  }
 
   clock_t end = clock();
   double elapsed_time = (end - start) / (double)CLOCKS_PER_SEC;
@@ -148,10 +178,200 @@ test_string_table(int no_elms)
     free(keys[i]); // we have ownership of these...
   }
 
+  free(contains);
   free(keys);
   string_free_table(table);
 }
 
+// A frozen set has the keys of the set we saved.
+void
+test_frozen(int no_elms)
+{
+  char path[] = "/tmp/generated_hash_test_XXXXXX";
+  close(mkstemp(path));
+
+  struct integer_hash_table *table = integer_new_table();
+  for (unsigned int i = 0; i < 2 * no_elms; ++i) {
+    integer_insert_key(table, i);
+  }
+  for (unsigned int i = no_elms; i < 2 * no_elms; ++i) {
+    integer_delete_key(table, i);
+  }
+  assert(integer_save_table(table, path));
+  integer_free_table(table);
+
+  struct integer_frozen_set *set = integer_load_frozen(path);
+  assert(set);
+  for (unsigned int i = 0; i < 2 * no_elms; ++i) {
+    assert(integer_frozen_contains_key(set, i) == (i < no_elms));
+  }
+  integer_free_frozen(set);
+
+  // A bin that ends before it starts would send lookups past the keys.
+  FILE *file = fopen(path, "r+b");
+  struct frozen_set_header header;
+  assert(fread(&header, sizeof header, 1, file) == 1);
+  uint64_t start = header.used + 1;
+  fseek(file, header.starts_offset + sizeof start, SEEK_SET);
+  fwrite(&start, sizeof start, 1, file);
+  fclose(file);
+  assert(!integer_load_frozen(path));
+
+  unlink(path);
+  assert(!integer_load_frozen(path));
+}
+
+// Hash each key once and use the hash with two tables.
+void
+test_with_hash(int no_elms)
+{
+  struct string_hash_table *first = string_new_table();
+  struct string_hash_table *second = string_new_table();
+  for (int i = 0; i < no_elms; ++i) {
+    char *key = itoa(i);
+    uint64_t hash_key = hash_str(key);
+    string_insert_key_with_hash(first, hash_key, strdup(key));
+    string_insert_key_with_hash(second, hash_key, key);
+  }
+  for (int i = 0; i < no_elms; ++i) {
+    char *key = itoa(i);
+    uint64_t hash_key = hash_str(key);
+    assert(string_contains_key(first, key));
+    assert(string_contains_key_with_hash(second, hash_key, key));
+    if (i % 2 == 0) {
+      string_delete_key_with_hash(first, hash_key, key);
+    }
+    free(key);
+  }
+  for (int i = 0; i < no_elms; ++i) {
+    char *key = itoa(i);
+    assert(string_contains_key_with_hash(first, hash_str(key), key) == i % 2);
+    assert(string_contains_key(second, key));
+    free(key);
+  }
+  string_free_table(first);
+  string_free_table(second);
+}
+
+// A pooled table reuses the links of deleted keys, and frees the keys it
+// still holds when we free it.
+void
+test_pooled(int no_elms)
+{
+  struct string_hash_table *table = string_new_pooled_table();
+  for (int round = 0; round < 3; ++round) {
+    for (int i = 0; i < no_elms; ++i) {
+      string_insert_key(table, itoa(i));
+    }
+    for (int i = 0; i < no_elms; i += 2) {
+      char *key = itoa(i);
+      string_delete_key(table, key);
+      free(key);
+    }
+    for (int i = 0; i < no_elms; ++i) {
+      char *key = itoa(i);
+      assert(string_contains_key(table, key) == i % 2);
+      free(key);
+    }
+    for (int i = 1; i < no_elms; i += 2) {
+      char *key = itoa(i);
+      string_delete_key(table, key);
+      free(key);
+    }
+    assert(table->used == 0);
+  }
+  for (int i = 0; i < no_elms; ++i) {
+    string_insert_key(table, itoa(i));
+  }
+  string_free_table(table);
+
+  struct integer_hash_table *ints = integer_new_pooled_table();
+  for (unsigned int i = 0; i < 4 * no_elms; ++i) {
+    integer_insert_key(ints, i);
+    if (i % 4 == 3)
+      integer_delete_key(ints, i - 2);
+  }
+  for (unsigned int i = 0; i < 4 * no_elms; ++i) {
+    assert(integer_contains_key(ints, i) == (i % 4 != 1));
+  }
+  integer_free_table(ints);
+}
+
+// A table with cached hash keys keeps them through resizes, both growing
+// and shrinking, and they match what HASH gives us.
+void
+test_cached(int no_elms)
+{
+  struct cached_string_hash_table *table = cached_string_new_table();
+  for (int i = 0; i < no_elms; ++i) {
+    cached_string_insert_key(table, itoa(i));
+  }
+  for (int i = 0; i < no_elms; i += 2) {
+    char *key = itoa(i);
+    cached_string_delete_key(table, key);
+    free(key);
+  }
+  char **keys = malloc(no_elms * sizeof *keys);
+  bool *contains = malloc(no_elms * sizeof *contains);
+  for (int i = 0; i < no_elms; ++i) {
+    keys[i] = itoa(i);
+    assert(cached_string_contains_key(table, keys[i]) == i % 2);
+  }
+  cached_string_contains_keys(table, keys, no_elms, contains);
+  for (int i = 0; i < no_elms; ++i) {
+    assert(contains[i] == i % 2);
+  }
+  for (size_t i = 0; i < table->size; ++i) {
+    struct cached_string_bin_link *link = table->bins[i].head;
+    for (; link; link = link->next) {
+      assert(link->key.hash_key == hash_str(link->key.key));
+      assert((link->key.hash_key & (table->size - 1)) == i);
+    }
+  }
+  for (int i = 0; i < no_elms; ++i) {
+    free(keys[i]);
+  }
+  free(contains);
+  free(keys);
+  cached_string_free_table(table);
+}
+
+// A table with unrolled lists in its bins, with and without a pool, through
+// growing and shrinking.
+void
+test_unrolled(int no_elms)
+{
+  struct unrolled_hash_table *tables[] = {unrolled_new_table(),
+                                          unrolled_new_pooled_table()};
+  for (int t = 0; t < 2; ++t) {
+    struct unrolled_hash_table *table = tables[t];
+    for (unsigned int i = 0; i < 2 * no_elms; ++i) {
+      unrolled_insert_key(table, i);
+      unrolled_insert_key(table, i);
+    }
+    struct hash_set_stats stats;
+    unrolled_table_stats(table, &stats);
+    assert(stats.used == 2 * no_elms);
+    for (unsigned int i = 0; i < 2 * no_elms; i += 2) {
+      unrolled_delete_key(table, i);
+    }
+    for (unsigned int i = no_elms; i < 2 * no_elms; ++i) {
+      unrolled_delete_key(table, i);
+    }
+    assert(table->used == no_elms / 2);
+    for (unsigned int i = 0; i < 3 * no_elms; ++i) {
+      assert(unrolled_contains_key(table, i) == (i < no_elms && i % 2));
+    }
+    unrolled_table_stats(table, &stats);
+    size_t keys = 0;
+    for (size_t i = 0; i < HASH_SET_STATS_BUCKETS; ++i) {
+      keys += i * stats.chain_lengths[i];
+    }
+    assert(keys == table->used);
+    unrolled_free_table(table);
+  }
+}
+
 int
 main(int argc, const char *argv[])
 {
@@ -163,6 +383,11 @@ main(int argc, const char *argv[])
   int no_elms = atoi(argv[1]);
   test_int_table(no_elms);
   test_string_table(no_elms);
+  test_with_hash(no_elms);
+  test_frozen(no_elms);
+  test_pooled(no_elms);
+  test_cached(no_elms);
+  test_unrolled(no_elms);
 
   return EXIT_SUCCESS;
 }
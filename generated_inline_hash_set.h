@@ -0,0 +1,301 @@
+#ifndef GENERATED_INLINE_HASH_SET_H
+#define GENERATED_INLINE_HASH_SET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "generated_hash_set.h"
+#include "generated_list.h"
+
+// A chained hash set where each bin holds its first key, and the key's hash
+// key, itself, and only the keys that collide with it go in a list of
+// overflow links. The table grows when it has as many keys as bins, so most
+// bins hold zero or one key, and most lookups never leave the bin array.
+// Inserting walks the bin once, and appends a new key at the end of the
+// overflow list if it didn't find it.
+//
+// The interface is the same as GEN_HASH_TABLE's, and like it, the set owns
+// its keys and frees them with KEY_DESTRUCTOR.
+
+#define INLINE_TABLE(NAME) struct NAME##_inline_table
+#define INLINE_BIN(NAME) struct NAME##_inline_bin
+#define INLINE_ENTRY(NAME) struct NAME##_inline_entry
+#define OVERFLOW_LINK(NAME) struct NAME##_overflow_link
+
+#define GEN_INLINE_STRUCTS(NAME, KEY_TYPE)                                     \
+  INLINE_ENTRY(NAME)                                                           \
+  {                                                                            \
+    uint64_t hash_key;                                                         \
+    KEY_TYPE key;                                                              \
+  };                                                                           \
+  GEN_LIST_STRUCTS(NAME##_overflow, INLINE_ENTRY(NAME))                        \
+  INLINE_BIN(NAME)                                                             \
+  {                                                                            \
+    INLINE_ENTRY(NAME) first;                                                  \
+    bool full; /* first holds a key; if not, the overflow list is empty */     \
+    LIST(NAME##_overflow) overflow;                                            \
+  };                                                                           \
+  INLINE_TABLE(NAME)                                                           \
+  {                                                                            \
+    INLINE_BIN(NAME) * bins;                                                   \
+    size_t size;                                                               \
+    size_t used;                                                               \
+    struct hash_set_counters counters;                                         \
+  };
+
+#define GEN_INLINE_BINS(NAME)                                                  \
+  static void HASH_FN(NAME, init_bins)(INLINE_TABLE(NAME) * table,             \
+                                       size_t size)                            \
+  {                                                                            \
+    table->bins = malloc(size * sizeof *table->bins);                          \
+    table->size = size;                                                        \
+    for (INLINE_BIN(NAME) *bin = table->bins; bin < table->bins + size;        \
+         bin++) {                                                              \
+      bin->full = false;                                                       \
+      bin->overflow.head = NULL;                                               \
+    }                                                                          \
+  }                                                                            \
+  static inline INLINE_BIN(NAME) *                                             \
+      HASH_FN(NAME, get_key_bin)(INLINE_TABLE(NAME) * table,                   \
+                                 uint64_t hash_key)                            \
+  {                                                                            \
+    return &table->bins[hash_key & (table->size - 1)];                         \
+  }
+
+#define GEN_INLINE_NEW_TABLE(NAME)                                             \
+  INLINE_TABLE(NAME) * HASH_FN(NAME, new_table)(void)                          \
+  {                                                                            \
+    INLINE_TABLE(NAME) *table = malloc(sizeof *table);                         \
+    *table = (INLINE_TABLE(NAME)){.used = 0, .counters = {0}};                 \
+    HASH_FN(NAME, init_bins)(table, MIN_SIZE);                                 \
+    return table;                                                              \
+  }
+
+#define GEN_INLINE_FREE_TABLE(NAME, KEY_DESTRUCTOR)                            \
+  void HASH_FN(NAME, free_table)(INLINE_TABLE(NAME) * table)                   \
+  {                                                                            \
+    for (INLINE_BIN(NAME) *bin = table->bins; bin < table->bins + table->size; \
+         bin++) {                                                              \
+      if (!bin->full)                                                          \
+        continue;                                                              \
+      KEY_DESTRUCTOR(bin->first.key);                                          \
+      LIST(NAME##_overflow) *overflow = &bin->overflow;                        \
+      for (ITR(overflow) itr = ITR_BEG(overflow); !ITR_END(itr);) {            \
+        KEY_DESTRUCTOR(ITR_DEREF(itr)->key.key);                               \
+        DELETE_LINK(itr);                                                      \
+      }                                                                        \
+    }                                                                          \
+    free(table->bins);                                                         \
+    free(table);                                                               \
+  }
+
+// Put an entry we know isn't in the table in its bin, in the bin itself if
+// it is empty and otherwise in LINK, or a new link if LINK is NULL.
+#define GEN_INLINE_RESIZE(NAME)                                                \
+  static void HASH_FN(NAME, place_entry)(INLINE_TABLE(NAME) * table,           \
+                                         INLINE_ENTRY(NAME) entry,             \
+                                         OVERFLOW_LINK(NAME) * link)           \
+  {                                                                            \
+    INLINE_BIN(NAME) *bin = HASH_FN(NAME, get_key_bin)(table, entry.hash_key); \
+    if (!bin->full) {                                                          \
+      bin->first = entry;                                                      \
+      bin->full = true;                                                        \
+      free(link);                                                              \
+    } else {                                                                   \
+      if (!link)                                                               \
+        link = malloc(sizeof *link);                                           \
+      link->key = entry;                                                       \
+      link->next = bin->overflow.head;                                         \
+      bin->overflow.head = link;                                               \
+    }                                                                          \
+  }                                                                            \
+  static void HASH_FN(NAME, resize)(INLINE_TABLE(NAME) * table,                \
+                                    size_t new_size)                           \
+  {                                                                            \
+    double start = hash_set_seconds();                                         \
+    INLINE_BIN(NAME) *old_bins = table->bins;                                  \
+    INLINE_BIN(NAME) *old_end = old_bins + table->size;                        \
+    HASH_FN(NAME, init_bins)(table, new_size);                                 \
+    for (INLINE_BIN(NAME) *bin = old_bins; bin < old_end; bin++) {             \
+      if (!bin->full)                                                          \
+        continue;                                                              \
+      HASH_FN(NAME, place_entry)(table, bin->first, NULL);                     \
+      while (bin->overflow.head) {                                             \
+        OVERFLOW_LINK(NAME) *link = bin->overflow.head;                        \
+        bin->overflow.head = link->next;                                       \
+        HASH_FN(NAME, place_entry)(table, link->key, link);                    \
+      }                                                                        \
+    }                                                                          \
+    free(old_bins);                                                            \
+    table->counters.resizes++;                                                 \
+    table->counters.resize_seconds += hash_set_seconds() - start;              \
+  }
+
+#define INLINE_MATCH(ENTRY, HASH_KEY, KEY, KEY_CMP)                            \
+  ((ENTRY).hash_key == (HASH_KEY) && KEY_CMP((ENTRY).key, KEY))
+
+// The _with_hash functions take a key we have already hashed with HASH.
+#define GEN_INLINE_INSERT_KEY(NAME, KEY_TYPE, KEY_CMP, HASH)                   \
+  void HASH_FN(NAME, insert_key_with_hash)(INLINE_TABLE(NAME) * table,         \
+                                           uint64_t hash_key, KEY_TYPE key)    \
+  {                                                                            \
+    HASH_SET_COUNT(table, finds);                                              \
+    INLINE_BIN(NAME) *bin = HASH_FN(NAME, get_key_bin)(table, hash_key);       \
+    INLINE_ENTRY(NAME) entry = {.hash_key = hash_key, .key = key};             \
+    if (!bin->full) {                                                          \
+      bin->first = entry;                                                      \
+      bin->full = true;                                                        \
+    } else {                                                                   \
+      if (INLINE_MATCH(bin->first, hash_key, key, KEY_CMP))                    \
+        return;                                                                \
+      LIST(NAME##_overflow) *overflow = &bin->overflow;                        \
+      ITR(overflow) itr = ITR_BEG(overflow);                                   \
+      for (; !ITR_END(itr); itr = ITR_NEXT(itr)) {                             \
+        if (INLINE_MATCH(ITR_DEREF(itr)->key, hash_key, key, KEY_CMP))         \
+          return;                                                              \
+      }                                                                        \
+      PUSH_NEW_LINK(itr); /* itr is the end of the list */                     \
+      ITR_DEREF(itr)->key = entry;                                             \
+    }                                                                          \
+    table->used++;                                                             \
+    if (table->size == table->used) {                                          \
+      HASH_FN(NAME, resize)(table, 2 * table->size);                           \
+    }                                                                          \
+  }                                                                            \
+  void HASH_FN(NAME, insert_key)(INLINE_TABLE(NAME) * table, KEY_TYPE key)     \
+  {                                                                            \
+    HASH_FN(NAME, insert_key_with_hash)(table, HASH(key), key);                \
+  }
+
+#define GEN_INLINE_CONTAINS_KEY(NAME, KEY_TYPE, KEY_CMP, HASH)                 \
+  static inline bool HASH_FN(NAME, bin_contains)(INLINE_BIN(NAME) * bin,       \
+                                                 uint64_t hash_key,            \
+                                                 KEY_TYPE key)                 \
+  {                                                                            \
+    if (!bin->full)                                                            \
+      return false;                                                            \
+    if (INLINE_MATCH(bin->first, hash_key, key, KEY_CMP))                      \
+      return true;                                                             \
+    for (OVERFLOW_LINK(NAME) *link = bin->overflow.head; link;                 \
+         link = link->next) {                                                  \
+      if (INLINE_MATCH(link->key, hash_key, key, KEY_CMP))                     \
+        return true;                                                           \
+    }                                                                          \
+    return false;                                                              \
+  }                                                                            \
+  bool HASH_FN(NAME, contains_key_with_hash)(INLINE_TABLE(NAME) * table,       \
+                                             uint64_t hash_key, KEY_TYPE key)  \
+  {                                                                            \
+    HASH_SET_COUNT(table, finds);                                              \
+    INLINE_BIN(NAME) *bin = HASH_FN(NAME, get_key_bin)(table, hash_key);       \
+    return HASH_FN(NAME, bin_contains)(bin, hash_key, key);                    \
+  }                                                                            \
+  bool HASH_FN(NAME, contains_key)(INLINE_TABLE(NAME) * table, KEY_TYPE key)   \
+  {                                                                            \
+    return HASH_FN(NAME, contains_key_with_hash)(table, HASH(key), key);       \
+  }
+
+// Without links to chase, prefetching the bins is all there is to do.
+#define GEN_INLINE_CONTAINS_KEYS(NAME, KEY_TYPE, HASH)                         \
+  void HASH_FN(NAME, contains_keys)(INLINE_TABLE(NAME) * table,                \
+                                    KEY_TYPE const *keys, size_t n,            \
+                                    bool *contains)                            \
+  {                                                                            \
+    INLINE_BIN(NAME) *bins[PREFETCH_BATCH];                                    \
+    uint64_t hash_keys[PREFETCH_BATCH];                                        \
+    for (size_t batch = 0; batch < n; batch += PREFETCH_BATCH) {               \
+      size_t m = n - batch < PREFETCH_BATCH ? n - batch : PREFETCH_BATCH;      \
+      KEY_TYPE const *batch_keys = keys + batch;                               \
+      for (size_t i = 0; i < m; i++) {                                         \
+        HASH_SET_COUNT(table, finds);                                          \
+        hash_keys[i] = HASH(batch_keys[i]);                                    \
+        bins[i] = HASH_FN(NAME, get_key_bin)(table, hash_keys[i]);             \
+        __builtin_prefetch(bins[i]);                                           \
+      }                                                                        \
+      for (size_t i = 0; i < m; i++) {                                         \
+        contains[batch + i] = HASH_FN(NAME, bin_contains)(                     \
+            bins[i], hash_keys[i], batch_keys[i]);                             \
+      }                                                                        \
+    }                                                                          \
+  }
+
+// Deleting the first key moves the first overflow key into the bin.
+#define GEN_INLINE_DELETE_KEY(NAME, KEY_TYPE, KEY_CMP, HASH, KEY_DESTRUCTOR)   \
+  void HASH_FN(NAME, delete_key_with_hash)(INLINE_TABLE(NAME) * table,         \
+                                           uint64_t hash_key, KEY_TYPE key)    \
+  {                                                                            \
+    HASH_SET_COUNT(table, finds);                                              \
+    INLINE_BIN(NAME) *bin = HASH_FN(NAME, get_key_bin)(table, hash_key);       \
+    if (!bin->full)                                                            \
+      return;                                                                  \
+    LIST(NAME##_overflow) *overflow = &bin->overflow;                          \
+    if (INLINE_MATCH(bin->first, hash_key, key, KEY_CMP)) {                    \
+      KEY_DESTRUCTOR(bin->first.key);                                          \
+      if (ITR_END(ITR_BEG(overflow))) {                                        \
+        bin->full = false;                                                     \
+      } else {                                                                 \
+        bin->first = overflow->head->key;                                      \
+        DELETE_LINK(ITR_BEG(overflow));                                        \
+      }                                                                        \
+    } else {                                                                   \
+      ITR(overflow) itr = ITR_BEG(overflow);                                   \
+      while (!ITR_END(itr) &&                                                  \
+             !INLINE_MATCH(ITR_DEREF(itr)->key, hash_key, key, KEY_CMP)) {     \
+        itr = ITR_NEXT(itr);                                                   \
+      }                                                                        \
+      if (ITR_END(itr))                                                        \
+        return;                                                                \
+      KEY_DESTRUCTOR(ITR_DEREF(itr)->key.key);                                 \
+      DELETE_LINK(itr);                                                        \
+    }                                                                          \
+    table->used--;                                                             \
+    if (table->size > MIN_SIZE && table->used < table->size / 4) {             \
+      HASH_FN(NAME, resize)(table, table->size / 2);                           \
+    }                                                                          \
+  }                                                                            \
+  void HASH_FN(NAME, delete_key)(INLINE_TABLE(NAME) * table, KEY_TYPE key)     \
+  {                                                                            \
+    HASH_FN(NAME, delete_key_with_hash)(table, HASH(key), key);                \
+  }
+
+// The same statistics as the chained tables give, with the first key in a
+// bin counting as a chain of length one.
+#define GEN_INLINE_TABLE_STATS(NAME)                                           \
+  void HASH_FN(NAME, table_stats)(INLINE_TABLE(NAME) * table,                  \
+                                  struct hash_set_stats *stats)                \
+  {                                                                            \
+    *stats = (struct hash_set_stats){.size = table->size,                      \
+                                     .used = table->used,                      \
+                                     .counters = table->counters};             \
+    stats->load_factor = (double)table->used / table->size;                    \
+    for (INLINE_BIN(NAME) *bin = table->bins; bin < table->bins + table->size; \
+         bin++) {                                                              \
+      size_t length = bin->full;                                               \
+      for (OVERFLOW_LINK(NAME) *link = bin->overflow.head; link;               \
+           link = link->next) {                                                \
+        length++;                                                              \
+      }                                                                        \
+      size_t bucket = length < HASH_SET_STATS_BUCKETS                          \
+                          ? length                                             \
+                          : HASH_SET_STATS_BUCKETS - 1;                        \
+      stats->chain_lengths[bucket]++;                                          \
+      if (length > stats->max_chain_length)                                    \
+        stats->max_chain_length = length;                                      \
+    }                                                                          \
+  }
+
+#define GEN_INLINE_HASH_TABLE(NAME, KEY_TYPE, KEY_CMP, HASH, KEY_DESTRUCTOR)   \
+  GEN_INLINE_STRUCTS(NAME, KEY_TYPE)                                           \
+  GEN_INLINE_BINS(NAME)                                                        \
+  GEN_INLINE_NEW_TABLE(NAME)                                                   \
+  GEN_INLINE_FREE_TABLE(NAME, KEY_DESTRUCTOR)                                  \
+  GEN_INLINE_RESIZE(NAME)                                                      \
+  GEN_INLINE_INSERT_KEY(NAME, KEY_TYPE, KEY_CMP, HASH)                         \
+  GEN_INLINE_CONTAINS_KEY(NAME, KEY_TYPE, KEY_CMP, HASH)                       \
+  GEN_INLINE_CONTAINS_KEYS(NAME, KEY_TYPE, HASH)                               \
+  GEN_INLINE_DELETE_KEY(NAME, KEY_TYPE, KEY_CMP, HASH, KEY_DESTRUCTOR)         \
+  GEN_INLINE_TABLE_STATS(NAME)
+
+#endif
@@ -0,0 +1,151 @@
+#define HASH_SET_STATS // so we can test the counters
+#include "generated_inline_hash_set.h"
+#include "hash.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char *
+itoa(unsigned int i)
+{
+  // Not super safe itoa, but good enough for an example like this.
+  char *buf = malloc(sizeof(char) * 20);
+  sprintf(buf, "%d", i);
+  return buf;
+}
+
+// comparison and dummy destructor for int keys
+#define EQ_CMP(A, B) ((A) == (B))
+#define NOP_DESTRUCTOR(KEY)
+
+GEN_INLINE_HASH_TABLE(integer, unsigned int, EQ_CMP, hash_u32,
+                      NOP_DESTRUCTOR);
+
+// A hash function that puts all keys in the same bin, so we get long
+// overflow lists.
+static uint64_t
+collide(unsigned int key)
+{
+  return 42;
+}
+GEN_INLINE_HASH_TABLE(colliding, unsigned int, EQ_CMP, collide,
+                      NOP_DESTRUCTOR);
+
+static void
+test_int_table(int no_elms)
+{
+  struct integer_inline_table *table = integer_new_table();
+  for (unsigned int i = 0; i < no_elms; ++i) {
+    integer_insert_key(table, i);
+    integer_insert_key(table, i); // no duplicates
+  }
+  assert(table->used == no_elms);
+  for (unsigned int i = 0; i < 2 * no_elms; ++i) {
+    assert(integer_contains_key(table, i) == (i < no_elms));
+  }
+
+  // Most keys have a bin to themselves.
+  struct hash_set_stats stats;
+  integer_table_stats(table, &stats);
+  assert(stats.used == no_elms);
+  assert(stats.chain_lengths[0] + stats.chain_lengths[1] > stats.size / 2);
+
+  for (unsigned int i = 0; i < no_elms; i += 2) {
+    integer_delete_key(table, i);
+    integer_delete_key(table, i);
+  }
+  assert(table->used == no_elms / 2);
+  unsigned int *keys = malloc(no_elms * sizeof *keys);
+  bool *contains = malloc(no_elms * sizeof *contains);
+  for (unsigned int i = 0; i < no_elms; ++i) {
+    keys[i] = i;
+  }
+  integer_contains_keys(table, keys, no_elms, contains);
+  for (unsigned int i = 0; i < no_elms; ++i) {
+    assert(contains[i] == i % 2);
+    assert(integer_contains_key(table, i) == i % 2);
+  }
+  for (unsigned int i = 1; i < no_elms; i += 2) {
+    integer_delete_key(table, i);
+  }
+  assert(table->used == 0 && table->size == MIN_SIZE);
+  free(contains);
+  free(keys);
+  integer_free_table(table);
+}
+
+// Deleting from the bin and from anywhere in the overflow list.
+static void
+test_overflow(int no_elms)
+{
+  struct colliding_inline_table *table = colliding_new_table();
+  for (unsigned int i = 0; i < no_elms; ++i) {
+    colliding_insert_key(table, i);
+  }
+  struct hash_set_stats stats;
+  colliding_table_stats(table, &stats);
+  assert(stats.max_chain_length == no_elms);
+
+  // The first key is in the bin, so deleting it moves the next one there.
+  colliding_delete_key(table, 0);
+  colliding_delete_key(table, no_elms - 1);
+  colliding_delete_key(table, no_elms / 2);
+  for (unsigned int i = 0; i < no_elms; ++i) {
+    bool deleted = i == 0 || i == no_elms - 1 || i == no_elms / 2;
+    assert(colliding_contains_key(table, i) == !deleted);
+  }
+  for (unsigned int i = 0; i < no_elms; ++i) {
+    colliding_delete_key(table, i);
+  }
+  assert(table->used == 0);
+  colliding_insert_key(table, 7);
+  assert(colliding_contains_key(table, 7));
+  colliding_free_table(table);
+}
+
+#define STR_EQ(A, B) (strcmp(A, B) == 0)
+GEN_INLINE_HASH_TABLE(string, char *, STR_EQ, hash_str, free);
+
+// The table frees the keys it holds when we delete them or free the table.
+static void
+test_string_table(int no_elms)
+{
+  struct string_inline_table *table = string_new_table();
+  for (unsigned int i = 0; i < no_elms; ++i) {
+    char *key = itoa(i);
+    string_insert_key_with_hash(table, hash_str(key), key);
+  }
+  for (unsigned int i = 0; i < 2 * no_elms; ++i) {
+    char *key = itoa(i);
+    assert(string_contains_key(table, key) == (i < no_elms));
+    if (i % 3 == 0)
+      string_delete_key_with_hash(table, hash_str(key), key);
+    free(key);
+  }
+  for (unsigned int i = 0; i < no_elms; ++i) {
+    char *key = itoa(i);
+    assert(string_contains_key_with_hash(table, hash_str(key), key) ==
+           (i % 3 != 0));
+    free(key);
+  }
+  assert(no_elms < MIN_SIZE || table->counters.resizes > 0);
+  string_free_table(table);
+}
+
+int
+main(int argc, const char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: %s no_elements\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  int no_elms = atoi(argv[1]);
+  test_int_table(no_elms);
+  test_overflow(no_elms);
+  test_string_table(no_elms);
+
+  return EXIT_SUCCESS;
+}
@@ -3,6 +3,7 @@
 #define GENERIC_LINKED_LISTS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 
 // The generated data structure has a link structure with a next pointer and
@@ -30,48 +31,157 @@
     struct LIST_NAME##_link *head;                                             \
   };
 
+// Link pools
+
+// A pool hands out links of one size from slabs it allocates a batch of links
+// at a time, and keeps the links we give back on a free list, threaded
+// through their first word, so adding and deleting keys doesn't go through
+// malloc() and free(). The links are only freed when we release the pool,
+// all at once. The functions that take a pool use malloc() and free() when
+// it is NULL.
+struct link_pool_slab {
+  struct link_pool_slab *next;
+  max_align_t links[]; // aligned for any link
+};
+struct link_pool {
+  struct link_pool_slab *slabs;
+  void *free_links;
+  char *next; // the rest of the newest slab
+  char *end;
+  size_t link_size;
+  size_t slab_links; // the number of links in the next slab
+};
+
+#define LINK_POOL_MIN_SLAB 16
+#define LINK_POOL_MAX_SLAB 4096
+
+// Initialiser for a pool of links of type LINK_TYPE
+#define NEW_LINK_POOL(LINK_TYPE)                                               \
+  { .link_size = sizeof(LINK_TYPE), .slab_links = LINK_POOL_MIN_SLAB }
+
+static inline void *
+link_pool_alloc(struct link_pool *pool)
+{
+  if (pool->free_links) {
+    void *link = pool->free_links;
+    pool->free_links = *(void **)link;
+    return link;
+  }
+  if (pool->next == pool->end) {
+    // Slabs grow with the pool, so small lists don't waste a large one
+    size_t bytes = pool->slab_links * pool->link_size;
+    struct link_pool_slab *slab = malloc(sizeof *slab + bytes);
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->next = (char *)slab->links;
+    pool->end = pool->next + bytes;
+    if (pool->slab_links < LINK_POOL_MAX_SLAB)
+      pool->slab_links *= 2;
+  }
+  void *link = pool->next;
+  pool->next += pool->link_size;
+  return link;
+}
+
+static inline void
+link_pool_free(struct link_pool *pool, void *link)
+{
+  *(void **)link = pool->free_links;
+  pool->free_links = link;
+}
+
+// Free all the links at once. The pool can be used again afterwards.
+static inline void
+link_pool_release(struct link_pool *pool)
+{
+  while (pool->slabs) {
+    struct link_pool_slab *next = pool->slabs->next;
+    free(pool->slabs);
+    pool->slabs = next;
+  }
+  pool->free_links = NULL;
+  pool->next = pool->end = NULL;
+  pool->slab_links = LINK_POOL_MIN_SLAB;
+}
+
+static inline void *
+new_link(struct link_pool *pool, size_t size)
+{
+  return pool ? link_pool_alloc(pool) : malloc(size);
+}
+
+static inline void
+free_link(struct link_pool *pool, void *link)
+{
+  if (pool)
+    link_pool_free(pool, link);
+  else
+    free(link);
+}
+
 // Rest of the interface
-#define PUSH_NEW_LINK(ITR)                                                     \
+#define PUSH_NEW_LINK(ITR) PUSH_POOL_LINK(ITR, NULL)
+#define DELETE_LINK(ITR) DELETE_POOL_LINK(ITR, NULL)
+
+#define PUSH_POOL_LINK(ITR, POOL)                                              \
   do {                                                                         \
-    typeof(**ITR) *link = malloc(sizeof *link);                                \
+    typeof(**ITR) *link = new_link(POOL, sizeof *link);                        \
     link->next = *(ITR);                                                       \
     *(ITR) = link;                                                             \
   } while (0)
 
-#define DELETE_LINK(ITR)                                                       \
+#define DELETE_POOL_LINK(ITR, POOL)                                            \
   do {                                                                         \
     typeof(**ITR) *next = (*(ITR))->next;                                      \
-    free(*(ITR));                                                              \
+    free_link(POOL, *(ITR));                                                   \
     *(ITR) = next;                                                             \
   } while (0)
 
+// The _pool functions take their links from POOL, or from malloc() if it
+// is NULL. Links must go back to the pool they came from.
 #define GEN_LIST_ADD_KEY(LIST_NAME, KEY_TYPE)                                  \
-  void LIST_NAME##_add_key(LIST(LIST_NAME) * list, KEY_TYPE key)               \
+  void LIST_NAME##_add_key_pool(LIST(LIST_NAME) * list,                        \
+                                struct link_pool *pool, KEY_TYPE key)          \
   {                                                                            \
-    PUSH_NEW_LINK(ITR_BEG(list));                                              \
+    PUSH_POOL_LINK(ITR_BEG(list), pool);                                       \
     ITR_DEREF(ITR_BEG(list))->key = key;                                       \
+  }                                                                            \
+  void LIST_NAME##_add_key(LIST(LIST_NAME) * list, KEY_TYPE key)               \
+  {                                                                            \
+    LIST_NAME##_add_key_pool(list, NULL, key);                                 \
   }
 
 #define GEN_LIST_FREE_LIST(LIST_NAME, KEY_TYPE, FREE_KEY)                      \
-  void LIST_NAME##_free_list(LIST(LIST_NAME) * list)                           \
+  void LIST_NAME##_free_list_pool(LIST(LIST_NAME) * list,                      \
+                                  struct link_pool *pool)                      \
   {                                                                            \
     ITR(list) itr = ITR_BEG(list);                                             \
     while (!ITR_END(itr)) {                                                    \
       FREE_KEY(ITR_DEREF(itr)->key);                                           \
-      DELETE_LINK(itr);                                                        \
+      DELETE_POOL_LINK(itr, pool);                                             \
     }                                                                          \
+  }                                                                            \
+  void LIST_NAME##_free_list(LIST(LIST_NAME) * list)                           \
+  {                                                                            \
+    LIST_NAME##_free_list_pool(list, NULL);                                    \
   }
 
 #define GEN_LIST_DELETE_KEY(LIST_NAME, KEY_TYPE, IS_EQ, FREE_KEY)              \
-  void LIST_NAME##_delete_key(LIST(LIST_NAME) * list, const KEY_TYPE key)      \
+  void LIST_NAME##_delete_key_pool(LIST(LIST_NAME) * list,                     \
+                                   struct link_pool *pool,                     \
+                                   const KEY_TYPE key)                         \
   {                                                                            \
     for (ITR(list) itr = ITR_BEG(list); !ITR_END(itr); itr = ITR_NEXT(itr)) {  \
       if (IS_EQ(ITR_DEREF(itr)->key, key)) {                                   \
         FREE_KEY(ITR_DEREF(itr)->key);                                         \
-        DELETE_LINK(itr);                                                      \
+        DELETE_POOL_LINK(itr, pool);                                           \
         return;                                                                \
       }                                                                        \
     }                                                                          \
+  }                                                                            \
+  void LIST_NAME##_delete_key(LIST(LIST_NAME) * list, const KEY_TYPE key)      \
+  {                                                                            \
+    LIST_NAME##_delete_key_pool(list, NULL, key);                              \
   }
 
 #define GEN_LIST_CONTAINS_KEY(LIST_NAME, KEY_TYPE, IS_EQ)                      \
@@ -85,11 +195,138 @@
     return false;                                                              \
   }
 
+#define GEN_LIST_LENGTH(LIST_NAME)                                             \
+  size_t LIST_NAME##_length(LIST(LIST_NAME) * list)                            \
+  {                                                                            \
+    size_t length = 0;                                                         \
+    for (ITR(list) itr = ITR_BEG(list); !ITR_END(itr); itr = ITR_NEXT(itr)) {  \
+      length++;                                                                \
+    }                                                                          \
+    return length;                                                             \
+  }
+
 #define GEN_LIST(LIST_NAME, KEY_TYPE, IS_EQ, FREE_KEY)                         \
   GEN_LIST_STRUCTS(LIST_NAME, KEY_TYPE);                                       \
   GEN_LIST_ADD_KEY(LIST_NAME, KEY_TYPE);                                       \
   GEN_LIST_DELETE_KEY(LIST_NAME, KEY_TYPE, IS_EQ, FREE_KEY);                   \
   GEN_LIST_CONTAINS_KEY(LIST_NAME, KEY_TYPE, IS_EQ);                           \
-  GEN_LIST_FREE_LIST(LIST_NAME, KEY_TYPE, FREE_KEY);
+  GEN_LIST_FREE_LIST(LIST_NAME, KEY_TYPE, FREE_KEY);                           \
+  GEN_LIST_LENGTH(LIST_NAME);
+
+// Unrolled lists
+
+// An unrolled list has the same interface as a list, but its links hold as
+// many keys as fit in a cache line, so there are fewer links to chase and
+// fewer next pointers to store. We add keys to the first link, and fill the
+// hole a deleted key leaves with the first link's last key, so every link
+// but the first is full. Since keys move between links, a key's position in
+// a link isn't stable.
+//
+// contains_key() compares all the keys in a link before it checks if one of
+// them matched, so IS_EQ shouldn't have side effects; for integer keys the
+// compiler can then compare them all at once with vector instructions.
+#define UNROLLED_LIST_KEYS(KEY_TYPE)                                           \
+  (sizeof(KEY_TYPE) < 64 - sizeof(void *) - sizeof(unsigned int)               \
+       ? (64 - sizeof(void *) - sizeof(unsigned int)) / sizeof(KEY_TYPE)       \
+       : 1)
+
+#define GEN_UNROLLED_LIST_STRUCTS(LIST_NAME, KEY_TYPE)                         \
+  struct LIST_NAME##_link {                                                    \
+    struct LIST_NAME##_link *next;                                             \
+    unsigned int count;                                                        \
+    KEY_TYPE keys[UNROLLED_LIST_KEYS(KEY_TYPE)];                               \
+  };                                                                           \
+  struct LIST_NAME##_list {                                                    \
+    struct LIST_NAME##_link *head;                                             \
+  };
+
+#define GEN_UNROLLED_LIST_ADD_KEY(LIST_NAME, KEY_TYPE)                         \
+  void LIST_NAME##_add_key_pool(LIST(LIST_NAME) * list,                        \
+                                struct link_pool *pool, KEY_TYPE key)          \
+  {                                                                            \
+    if (ITR_END(ITR_BEG(list)) ||                                              \
+        list->head->count == UNROLLED_LIST_KEYS(KEY_TYPE)) {                   \
+      PUSH_POOL_LINK(ITR_BEG(list), pool);                                     \
+      list->head->count = 0;                                                   \
+    }                                                                          \
+    list->head->keys[list->head->count++] = key;                               \
+  }                                                                            \
+  void LIST_NAME##_add_key(LIST(LIST_NAME) * list, KEY_TYPE key)               \
+  {                                                                            \
+    LIST_NAME##_add_key_pool(list, NULL, key);                                 \
+  }
+
+#define GEN_UNROLLED_LIST_FREE_LIST(LIST_NAME, KEY_TYPE, FREE_KEY)             \
+  void LIST_NAME##_free_list_pool(LIST(LIST_NAME) * list,                      \
+                                  struct link_pool *pool)                      \
+  {                                                                            \
+    ITR(list) itr = ITR_BEG(list);                                             \
+    while (!ITR_END(itr)) {                                                    \
+      for (unsigned int i = 0; i < ITR_DEREF(itr)->count; i++) {               \
+        FREE_KEY(ITR_DEREF(itr)->keys[i]);                                     \
+      }                                                                        \
+      DELETE_POOL_LINK(itr, pool);                                             \
+    }                                                                          \
+  }                                                                            \
+  void LIST_NAME##_free_list(LIST(LIST_NAME) * list)                           \
+  {                                                                            \
+    LIST_NAME##_free_list_pool(list, NULL);                                    \
+  }
+
+#define GEN_UNROLLED_LIST_DELETE_KEY(LIST_NAME, KEY_TYPE, IS_EQ, FREE_KEY)     \
+  void LIST_NAME##_delete_key_pool(LIST(LIST_NAME) * list,                     \
+                                   struct link_pool *pool,                     \
+                                   const KEY_TYPE key)                         \
+  {                                                                            \
+    for (ITR(list) itr = ITR_BEG(list); !ITR_END(itr); itr = ITR_NEXT(itr)) {  \
+      struct LIST_NAME##_link *link = ITR_DEREF(itr);                          \
+      for (unsigned int i = 0; i < link->count; i++) {                         \
+        if (IS_EQ(link->keys[i], key)) {                                       \
+          FREE_KEY(link->keys[i]);                                             \
+          link->keys[i] = list->head->keys[--list->head->count];               \
+          if (list->head->count == 0)                                          \
+            DELETE_POOL_LINK(ITR_BEG(list), pool);                             \
+          return;                                                              \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+  void LIST_NAME##_delete_key(LIST(LIST_NAME) * list, const KEY_TYPE key)      \
+  {                                                                            \
+    LIST_NAME##_delete_key_pool(list, NULL, key);                              \
+  }
+
+#define GEN_UNROLLED_LIST_CONTAINS_KEY(LIST_NAME, KEY_TYPE, IS_EQ)             \
+  bool LIST_NAME##_contains_key(LIST(LIST_NAME) * list, const KEY_TYPE key)    \
+  {                                                                            \
+    for (ITR(list) itr = ITR_BEG(list); !ITR_END(itr); itr = ITR_NEXT(itr)) {  \
+      struct LIST_NAME##_link *link = ITR_DEREF(itr);                          \
+      unsigned int matches = 0;                                                \
+      for (unsigned int i = 0; i < link->count; i++) {                         \
+        matches += IS_EQ(link->keys[i], key);                                  \
+      }                                                                        \
+      if (matches)                                                             \
+        return true;                                                           \
+    }                                                                          \
+    return false;                                                              \
+  }
+
+#define GEN_UNROLLED_LIST_LENGTH(LIST_NAME)                                    \
+  size_t LIST_NAME##_length(LIST(LIST_NAME) * list)                            \
+  {                                                                            \
+    size_t length = 0;                                                         \
+    for (ITR(list) itr = ITR_BEG(list); !ITR_END(itr); itr = ITR_NEXT(itr)) {  \
+      length += ITR_DEREF(itr)->count;                                         \
+    }                                                                          \
+    return length;                                                             \
+  }
+
+#define GEN_UNROLLED_LIST(LIST_NAME, KEY_TYPE, IS_EQ, FREE_KEY)                \
+  GEN_UNROLLED_LIST_STRUCTS(LIST_NAME, KEY_TYPE);                              \
+  GEN_UNROLLED_LIST_ADD_KEY(LIST_NAME, KEY_TYPE);                              \
+  GEN_UNROLLED_LIST_DELETE_KEY(LIST_NAME, KEY_TYPE, IS_EQ, FREE_KEY);          \
+  GEN_UNROLLED_LIST_CONTAINS_KEY(LIST_NAME, KEY_TYPE, IS_EQ);                  \
+  GEN_UNROLLED_LIST_FREE_LIST(LIST_NAME, KEY_TYPE, FREE_KEY);                  \
+  GEN_UNROLLED_LIST_LENGTH(LIST_NAME);
 
 #endif
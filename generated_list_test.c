@@ -20,6 +20,9 @@ GEN_LIST(intp, unsigned int *, DEREF_EQ_CMP, free);
 #define STR_EQ(A, B) (strcmp(A, B) == 0)
 GEN_LIST(str, char *, STR_EQ, free);
 
+GEN_UNROLLED_LIST(uint, unsigned int, EQ_CMP, NOP_DESTRUCTOR);
+GEN_UNROLLED_LIST(ustr, char *, STR_EQ, free);
+
 static void
 test_int_list(void)
 {
@@ -169,6 +172,87 @@ test_str_list(void)
   str_free_list(&owner);
 }
 
+// Lists can share a pool, and the pool hands deleted links out again.
+static void
+test_pooled_list(void)
+{
+  struct link_pool pool = NEW_LINK_POOL(struct str_link);
+  struct str_list first = NEW_LIST(), second = NEW_LIST();
+  char key[20];
+  for (int i = 0; i < 100; i++) {
+    sprintf(key, "%d", i);
+    str_add_key_pool(&first, &pool, str_dup(key));
+    str_add_key_pool(&second, &pool, str_dup(key));
+  }
+  struct str_link *head = second.head;
+  str_delete_key_pool(&second, &pool, "99");
+  str_add_key_pool(&second, &pool, str_dup("100"));
+  assert(second.head == head); // the link we just freed
+
+  for (int i = 0; i < 100; i++) {
+    sprintf(key, "%d", i);
+    assert(str_contains_key(&first, key));
+    assert(str_contains_key(&second, key) == (i != 99));
+  }
+  assert(str_contains_key(&second, "100"));
+
+  // Freeing a list gives its links back to the pool; releasing the pool
+  // frees them.
+  str_free_list_pool(&first, &pool);
+  str_free_list_pool(&second, &pool);
+  assert(!first.head && !second.head);
+  link_pool_release(&pool);
+}
+
+// Deleting keys from the middle of an unrolled list keeps all links but the
+// first full.
+static void
+test_unrolled_list(void)
+{
+  unsigned int n = 10 * UNROLLED_LIST_KEYS(unsigned int) + 3;
+  struct uint_list owner = NEW_LIST();
+  for (unsigned int i = 0; i < n; i++) {
+    uint_add_key(&owner, i);
+  }
+  assert(uint_length(&owner) == n);
+  for (unsigned int i = 0; i < n; i += 3) {
+    uint_delete_key(&owner, i);
+  }
+  uint_delete_key(&owner, n); // not in the list
+  for (unsigned int i = 0; i < n; i++) {
+    assert(uint_contains_key(&owner, i) == (i % 3 != 0));
+  }
+  assert(uint_length(&owner) == n - (n + 2) / 3);
+  for (struct uint_link *link = owner.head->next; link; link = link->next) {
+    assert(link->count == UNROLLED_LIST_KEYS(unsigned int));
+  }
+  for (unsigned int i = 0; i < n; i++) {
+    uint_delete_key(&owner, i);
+  }
+  assert(!owner.head);
+  uint_free_list(&owner);
+
+  // The list frees the keys it deletes and the keys it holds when we free
+  // it, and its links can come from a pool.
+  struct link_pool pool = NEW_LINK_POOL(struct ustr_link);
+  struct ustr_list strings = NEW_LIST();
+  char key[20];
+  for (int i = 0; i < 100; i++) {
+    sprintf(key, "%d", i);
+    ustr_add_key_pool(&strings, &pool, str_dup(key));
+  }
+  for (int i = 0; i < 100; i += 2) {
+    sprintf(key, "%d", i);
+    ustr_delete_key_pool(&strings, &pool, key);
+  }
+  for (int i = 0; i < 100; i++) {
+    sprintf(key, "%d", i);
+    assert(ustr_contains_key(&strings, key) == i % 2);
+  }
+  ustr_free_list_pool(&strings, &pool);
+  link_pool_release(&pool);
+}
+
 int
 main()
 {
@@ -178,6 +262,10 @@ main()
   test_intp_list();
   printf("generated char* list\n");
   test_str_list();
+  printf("generated char* list with a link pool\n");
+  test_pooled_list();
+  printf("generated unrolled lists\n");
+  test_unrolled_list();
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,268 @@
+
+#ifndef GENERATED_OA_MAP_H
+#define GENERATED_OA_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "control_bytes.h"
+
+// An open addressing map generated for one key and value type, with the
+// control bytes and group probing of open_addressing_map.c. Keys and values
+// are stored in the bins, and HASH, KEY_CMP and the destructors are called
+// directly, so the compiler can inline them. HASH takes a key and returns a
+// uint64_t hash key, like the functions in hash.h.
+//
+// Like the generated sets, the map owns the keys and values we give it and
+// frees them with the destructors. Adding a key that is already there
+// replaces both the key and the value. Deleted keys leave tombstones; the map
+// grows when more than half its bins are used, clears the tombstones instead
+// if most of the used bins are tombstones, and shrinks when fewer than an
+// eighth of the bins hold keys.
+
+#define OA_MAP(NAME) struct NAME##_oa_map
+#define OA_BIN(NAME) struct NAME##_oa_bin
+#define OA_FN(NAME, FUNC_NAME) NAME##_##FUNC_NAME
+
+#define OA_MIN_SIZE 8
+
+#define GEN_OA_STRUCTS(NAME, KEY_TYPE, VAL_TYPE)                               \
+  OA_BIN(NAME)                                                                 \
+  {                                                                            \
+    KEY_TYPE key;                                                              \
+    VAL_TYPE value;                                                            \
+  };                                                                           \
+  OA_MAP(NAME)                                                                 \
+  {                                                                            \
+    uint8_t *ctrl; /* control bytes and their mirror */                        \
+    OA_BIN(NAME) * bins;                                                       \
+    size_t size;                                                               \
+    size_t used;   /* bins with a key or a tombstone */                        \
+    size_t active; /* bins with a key */                                       \
+  };
+
+#define GEN_OA_INIT_BINS(NAME)                                                 \
+  static void OA_FN(NAME, init_bins)(OA_MAP(NAME) * map, size_t size)          \
+  {                                                                            \
+    map->ctrl = malloc(size + GROUP_WIDTH - 1);                                \
+    memset(map->ctrl, CTRL_EMPTY, size + GROUP_WIDTH - 1);                     \
+    map->bins = malloc(size * sizeof *map->bins);                              \
+    map->size = size;                                                          \
+    map->used = 0;                                                             \
+    map->active = 0;                                                           \
+  }
+
+#define GEN_OA_NEW_TABLE(NAME)                                                 \
+  OA_MAP(NAME) * OA_FN(NAME, new_table)(void)                                  \
+  {                                                                            \
+    OA_MAP(NAME) *map = malloc(sizeof *map);                                   \
+    OA_FN(NAME, init_bins)(map, OA_MIN_SIZE);                                  \
+    return map;                                                                \
+  }
+
+#define GEN_OA_FREE_TABLE(NAME, KEY_DESTRUCTOR, VAL_DESTRUCTOR)                \
+  void OA_FN(NAME, free_table)(OA_MAP(NAME) * map)                             \
+  {                                                                            \
+    for (size_t i = 0; i < map->size; i++) {                                   \
+      if (is_full(map->ctrl[i])) {                                             \
+        KEY_DESTRUCTOR(map->bins[i].key);                                      \
+        VAL_DESTRUCTOR(map->bins[i].value);                                    \
+      }                                                                        \
+    }                                                                          \
+    free(map->ctrl);                                                           \
+    free(map->bins);                                                           \
+    free(map);                                                                 \
+  }
+
+// find_key() gives us the bin with the key, or the first bin past the end of
+// its probe. find_bin() gives us the bin with the key, or the first empty or
+// deleted bin in its probe, where we would add it.
+#define GEN_OA_FIND(NAME, KEY_TYPE, KEY_CMP)                                   \
+  static inline size_t OA_FN(NAME, find_key)(OA_MAP(NAME) * map,               \
+                                             uint64_t hash_key, KEY_TYPE key)  \
+  {                                                                            \
+    size_t mask = map->size - 1;                                               \
+    for (size_t i = 0; i < no_groups(map->size); i++) {                        \
+      size_t pos = (hash_key + i * GROUP_WIDTH) & mask;                        \
+      uint8_t const *group = map->ctrl + pos;                                  \
+      for (group_mask m = match_byte(group, h7(hash_key)); m; m &= m - 1) {    \
+        size_t bin = (pos + first_bit(m)) & mask;                              \
+        if (KEY_CMP(map->bins[bin].key, key))                                  \
+          return bin;                                                          \
+      }                                                                        \
+      group_mask empty = match_empty(group);                                   \
+      if (empty)                                                               \
+        return (pos + first_bit(empty)) & mask;                                \
+    }                                                                          \
+    abort(); /* we should never get here */                                    \
+  }                                                                            \
+  static inline size_t OA_FN(NAME, find_empty)(OA_MAP(NAME) * map,             \
+                                               uint64_t hash_key)              \
+  {                                                                            \
+    size_t mask = map->size - 1;                                               \
+    for (size_t i = 0; i < no_groups(map->size); i++) {                        \
+      size_t pos = (hash_key + i * GROUP_WIDTH) & mask;                        \
+      group_mask empty = match_empty_or_deleted(map->ctrl + pos);              \
+      if (empty)                                                               \
+        return (pos + first_bit(empty)) & mask;                                \
+    }                                                                          \
+    abort(); /* we should never get here */                                    \
+  }                                                                            \
+  static inline size_t OA_FN(NAME, find_bin)(OA_MAP(NAME) * map,               \
+                                             uint64_t hash_key, KEY_TYPE key)  \
+  {                                                                            \
+    size_t mask = map->size - 1;                                               \
+    size_t empty = SIZE_MAX; /* the first empty or deleted bin */              \
+    for (size_t i = 0; i < no_groups(map->size); i++) {                        \
+      size_t pos = (hash_key + i * GROUP_WIDTH) & mask;                        \
+      uint8_t const *group = map->ctrl + pos;                                  \
+      for (group_mask m = match_byte(group, h7(hash_key)); m; m &= m - 1) {    \
+        size_t bin = (pos + first_bit(m)) & mask;                              \
+        if (KEY_CMP(map->bins[bin].key, key))                                  \
+          return bin;                                                          \
+      }                                                                        \
+      group_mask empty_or_deleted = match_empty_or_deleted(group);             \
+      if (empty == SIZE_MAX && empty_or_deleted)                               \
+        empty = (pos + first_bit(empty_or_deleted)) & mask;                    \
+      if (match_empty(group))                                                  \
+        return empty;                                                          \
+    }                                                                          \
+    abort(); /* we should never get here */                                    \
+  }
+
+// Move the keys to new bins. Resizing to the same size clears tombstones.
+#define GEN_OA_RESIZE(NAME, HASH)                                              \
+  static void OA_FN(NAME, resize)(OA_MAP(NAME) * map, size_t new_size)         \
+  {                                                                            \
+    uint8_t *old_ctrl = map->ctrl;                                             \
+    OA_BIN(NAME) *old_bins = map->bins;                                        \
+    size_t old_size = map->size;                                               \
+    OA_FN(NAME, init_bins)(map, new_size);                                     \
+    for (size_t i = 0; i < old_size; i++) {                                    \
+      if (is_full(old_ctrl[i])) {                                              \
+        uint64_t hash_key = HASH(old_bins[i].key);                             \
+        size_t bin = OA_FN(NAME, find_empty)(map, hash_key);                   \
+        set_ctrl_byte(map->ctrl, map->size, bin, h7(hash_key));                \
+        map->bins[bin] = old_bins[i];                                          \
+        map->used++;                                                           \
+        map->active++;                                                         \
+      }                                                                        \
+    }                                                                          \
+    free(old_ctrl);                                                            \
+    free(old_bins);                                                            \
+  }
+
+// Claim the empty or deleted bin find_bin() gave us for a new key, growing
+// the table first if it is full, so the bin stays put once we return it.
+#define GEN_OA_NEW_KEY_BIN(NAME)                                               \
+  static inline size_t OA_FN(NAME, new_key_bin)(OA_MAP(NAME) * map,            \
+                                                uint64_t hash_key,             \
+                                                size_t bin)                    \
+  {                                                                            \
+    if (map->used + (map->ctrl[bin] == CTRL_EMPTY) > map->size / 2) {          \
+      size_t size = map->active < map->size / 4 ? map->size : 2 * map->size;   \
+      OA_FN(NAME, resize)(map, size);                                          \
+      bin = OA_FN(NAME, find_empty)(map, hash_key);                            \
+    }                                                                          \
+    map->used += map->ctrl[bin] == CTRL_EMPTY;                                 \
+    map->active++;                                                             \
+    set_ctrl_byte(map->ctrl, map->size, bin, h7(hash_key));                    \
+    return bin;                                                                \
+  }
+
+// The _with_hash functions take a key we have already hashed with HASH, so
+// a key can be hashed once and then used with several maps.
+#define GEN_OA_ADD_MAP(NAME, KEY_TYPE, VAL_TYPE, HASH, KEY_DESTRUCTOR,         \
+                       VAL_DESTRUCTOR)                                         \
+  void OA_FN(NAME, add_map_with_hash)(OA_MAP(NAME) * map, uint64_t hash_key,   \
+                                      KEY_TYPE key, VAL_TYPE value)            \
+  {                                                                            \
+    size_t bin = OA_FN(NAME, find_bin)(map, hash_key, key);                    \
+    if (is_full(map->ctrl[bin])) {                                             \
+      KEY_DESTRUCTOR(map->bins[bin].key);                                      \
+      VAL_DESTRUCTOR(map->bins[bin].value);                                    \
+    } else {                                                                   \
+      bin = OA_FN(NAME, new_key_bin)(map, hash_key, bin);                      \
+    }                                                                          \
+    map->bins[bin].key = key;                                                  \
+    map->bins[bin].value = value;                                              \
+  }                                                                            \
+  void OA_FN(NAME, add_map)(OA_MAP(NAME) * map, KEY_TYPE key, VAL_TYPE value)  \
+  {                                                                            \
+    OA_FN(NAME, add_map_with_hash)(map, HASH(key), key, value);                \
+  }
+
+#define GEN_OA_LOOKUP_KEY(NAME, KEY_TYPE, VAL_TYPE, HASH)                      \
+  VAL_TYPE *OA_FN(NAME, lookup_key_with_hash)(OA_MAP(NAME) * map,              \
+                                              uint64_t hash_key, KEY_TYPE key) \
+  {                                                                            \
+    size_t bin = OA_FN(NAME, find_key)(map, hash_key, key);                    \
+    return is_full(map->ctrl[bin]) ? &map->bins[bin].value : NULL;             \
+  }                                                                            \
+  VAL_TYPE *OA_FN(NAME, lookup_key)(OA_MAP(NAME) * map, KEY_TYPE key)          \
+  {                                                                            \
+    return OA_FN(NAME, lookup_key_with_hash)(map, HASH(key), key);             \
+  }
+
+// Find the key, or add it with a zero value, with a single probe. If the key
+// is already there, we still own the one we passed. The value pointer is
+// valid until the map is next modified.
+#define GEN_OA_FIND_OR_INSERT(NAME, KEY_TYPE, VAL_TYPE, HASH)                  \
+  VAL_TYPE *OA_FN(NAME, find_or_insert_with_hash)(                             \
+      OA_MAP(NAME) * map, uint64_t hash_key, KEY_TYPE key, bool *inserted)     \
+  {                                                                            \
+    size_t bin = OA_FN(NAME, find_bin)(map, hash_key, key);                    \
+    *inserted = !is_full(map->ctrl[bin]);                                      \
+    if (*inserted) {                                                           \
+      bin = OA_FN(NAME, new_key_bin)(map, hash_key, bin);                      \
+      map->bins[bin].key = key;                                                \
+      map->bins[bin].value = (VAL_TYPE){0};                                    \
+    }                                                                          \
+    return &map->bins[bin].value;                                              \
+  }                                                                            \
+  VAL_TYPE *OA_FN(NAME, find_or_insert)(OA_MAP(NAME) * map, KEY_TYPE key,      \
+                                        bool *inserted)                        \
+  {                                                                            \
+    return OA_FN(NAME, find_or_insert_with_hash)(map, HASH(key), key,          \
+                                                 inserted);                    \
+  }
+
+#define GEN_OA_DELETE_KEY(NAME, KEY_TYPE, HASH, KEY_DESTRUCTOR,                \
+                          VAL_DESTRUCTOR)                                      \
+  void OA_FN(NAME, delete_key_with_hash)(OA_MAP(NAME) * map,                   \
+                                         uint64_t hash_key, KEY_TYPE key)      \
+  {                                                                            \
+    size_t bin = OA_FN(NAME, find_key)(map, hash_key, key);                    \
+    if (!is_full(map->ctrl[bin]))                                              \
+      return;                                                                  \
+    KEY_DESTRUCTOR(map->bins[bin].key);                                        \
+    VAL_DESTRUCTOR(map->bins[bin].value);                                      \
+    set_ctrl_byte(map->ctrl, map->size, bin, CTRL_DELETED);                    \
+    map->active--;                                                             \
+    if (map->size > OA_MIN_SIZE && map->active < map->size / 8)                \
+      OA_FN(NAME, resize)(map, map->size / 2);                                 \
+  }                                                                            \
+  void OA_FN(NAME, delete_key)(OA_MAP(NAME) * map, KEY_TYPE key)               \
+  {                                                                            \
+    OA_FN(NAME, delete_key_with_hash)(map, HASH(key), key);                    \
+  }
+
+#define GEN_OA_MAP(NAME, KEY_TYPE, VAL_TYPE, HASH, KEY_CMP, KEY_DESTRUCTOR,    \
+                   VAL_DESTRUCTOR)                                             \
+  GEN_OA_STRUCTS(NAME, KEY_TYPE, VAL_TYPE)                                     \
+  GEN_OA_INIT_BINS(NAME)                                                       \
+  GEN_OA_NEW_TABLE(NAME)                                                       \
+  GEN_OA_FREE_TABLE(NAME, KEY_DESTRUCTOR, VAL_DESTRUCTOR)                      \
+  GEN_OA_FIND(NAME, KEY_TYPE, KEY_CMP)                                         \
+  GEN_OA_RESIZE(NAME, HASH)                                                    \
+  GEN_OA_NEW_KEY_BIN(NAME)                                                     \
+  GEN_OA_ADD_MAP(NAME, KEY_TYPE, VAL_TYPE, HASH, KEY_DESTRUCTOR,               \
+                 VAL_DESTRUCTOR)                                               \
+  GEN_OA_LOOKUP_KEY(NAME, KEY_TYPE, VAL_TYPE, HASH)                            \
+  GEN_OA_FIND_OR_INSERT(NAME, KEY_TYPE, VAL_TYPE, HASH)                        \
+  GEN_OA_DELETE_KEY(NAME, KEY_TYPE, HASH, KEY_DESTRUCTOR, VAL_DESTRUCTOR)
+
+#endif
@@ -0,0 +1,133 @@
+#include "generated_oa_map.h"
+#include "hash.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char *
+itoa(unsigned int i)
+{
+  // Not super safe itoa, but good enough for an example like this.
+  char *buf = malloc(sizeof(char) * 20);
+  sprintf(buf, "%d", i);
+  return buf;
+}
+
+// comparison and dummy destructor for int keys
+#define EQ_CMP(A, B) ((A) == (B))
+#define NOP_DESTRUCTOR(KEY)
+
+GEN_OA_MAP(integer, uint32_t, uint32_t, hash_u32, EQ_CMP, NOP_DESTRUCTOR,
+           NOP_DESTRUCTOR)
+
+static void
+test_int_map(int no_elms)
+{
+  struct integer_oa_map *map = integer_new_table();
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    integer_add_map(map, i, i);
+  }
+  assert(map->active == no_elms);
+  for (uint32_t i = 0; i < 2 * no_elms; ++i) {
+    uint32_t *val = integer_lookup_key(map, i);
+    assert(i < no_elms ? *val == i : !val);
+  }
+
+  // Replace the values of the even keys and delete the odd ones.
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    if (i % 2)
+      integer_delete_key(map, i);
+    else
+      integer_add_map_with_hash(map, hash_u32(i), i, 2 * i);
+  }
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    uint32_t *val = integer_lookup_key_with_hash(map, hash_u32(i), i);
+    assert(i % 2 ? !val : *val == 2 * i);
+  }
+
+  // Churn through many more keys than the map holds at a time, so it has to
+  // clear tombstones.
+  size_t size = map->size;
+  for (uint32_t i = no_elms; i < 10 * no_elms; ++i) {
+    integer_add_map(map, i, i);
+    integer_delete_key(map, i);
+  }
+  assert(map->size == size);
+  assert(map->used < map->size);
+
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    integer_delete_key(map, i);
+  }
+  assert(map->active == 0 && map->size == OA_MIN_SIZE);
+
+  integer_free_table(map);
+}
+
+// Count how often each key occurs, updating the counts in place.
+static void
+test_find_or_insert(int no_elms)
+{
+  struct integer_oa_map *map = integer_new_table();
+  for (uint32_t round = 0; round < 3; ++round) {
+    for (uint32_t i = 0; i < no_elms; ++i) {
+      bool inserted;
+      uint32_t *count = integer_find_or_insert(map, i, &inserted);
+      assert(inserted == (round == 0));
+      assert(*count == round);
+      ++*count;
+    }
+  }
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    assert(*integer_lookup_key(map, i) == 3);
+  }
+  integer_free_table(map);
+}
+
+// String map, where the map takes ownership of keys and values and frees
+// them.
+#define STR_EQ(A, B) (strcmp(A, B) == 0)
+GEN_OA_MAP(string, char *, char *, hash_str, STR_EQ, free, free)
+
+static void
+test_string_map(int no_elms)
+{
+  struct string_oa_map *map = string_new_table();
+  for (int i = 0; i < no_elms; ++i) {
+    string_add_map(map, itoa(i), itoa(i));
+  }
+  for (int i = 0; i < no_elms; ++i) {
+    string_add_map(map, itoa(i), itoa(2 * i)); // frees the old ones
+  }
+  for (int i = 0; i < no_elms; ++i) {
+    char *key = itoa(i);
+    char **val = string_lookup_key(map, key);
+    assert(atoi(*val) == 2 * i);
+    if (i % 2)
+      string_delete_key(map, key);
+    free(key);
+  }
+  for (int i = 0; i < no_elms; ++i) {
+    char *key = itoa(i);
+    assert((string_lookup_key(map, key) != NULL) == (i % 2 == 0));
+    free(key);
+  }
+  string_free_table(map);
+}
+
+int
+main(int argc, const char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: %s no_elements\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  int no_elms = atoi(argv[1]);
+  test_int_map(no_elms);
+  test_find_or_insert(no_elms);
+  test_string_map(no_elms);
+
+  return EXIT_SUCCESS;
+}
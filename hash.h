@@ -0,0 +1,201 @@
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// 64-bit hash functions for integer and string keys. The tables pick bins
+// with the low bits of a hash key and match control bytes on the high bits,
+// so every bit of the key has to affect all the bits of the hash.
+//
+// hash_u32() and hash_str() take the keys themselves and can be used as the
+// HASH in GEN_HASH_TABLE. hash_u32_key() and hash_str_key() take pointers to
+// the keys and are hash_func's for a struct key_type, and the _seeded_ ones
+// are seeded_hash_func's. The functions are inline so the generated tables,
+// which live entirely in headers, can use them without linking anything.
+
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+#define HASH_P2 0x8ebc6af09c88c6e3ull
+#define HASH_P3 0x589965cc75374cc3ull
+
+// 64x64 -> 128 bit multiplication, folded back to 64 bits.
+static inline uint64_t
+hash_mum(uint64_t a, uint64_t b)
+{
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t
+hash_read64(uint8_t const *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof v);
+  return v;
+}
+
+static inline uint64_t
+hash_read32(uint8_t const *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof v);
+  return v;
+}
+
+// Integers
+
+// A bijective mixer (the splitmix64 finaliser), so different keys never
+// collide before the table reduces the hash to a bin.
+static inline uint64_t
+hash_u64(uint64_t key)
+{
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111eb;
+  key ^= key >> 31;
+  return key;
+}
+
+static inline uint64_t
+hash_u32(uint32_t key)
+{
+  return hash_u64(key);
+}
+
+static inline uint64_t
+hash_u64_seeded(uint64_t key, uint64_t seed)
+{
+  return hash_mum(key ^ seed ^ HASH_P0, HASH_P1);
+}
+
+static inline uint64_t
+hash_u32_seeded(uint32_t key, uint64_t seed)
+{
+  return hash_u64_seeded(key, seed);
+}
+
+// Strings
+
+// In the style of wyhash: the bytes are read 64 bits at a time and mixed
+// with 128-bit multiplications, on three independent lanes for long inputs.
+// Inputs of up to 16 bytes are covered by (possibly overlapping) reads from
+// both ends, so there are no loops or byte-at-a-time tails.
+static inline uint64_t
+hash_bytes(void const *data, size_t len, uint64_t seed)
+{
+  uint8_t const *p = data;
+  uint64_t a, b;
+  seed ^= hash_mum(seed ^ HASH_P0, HASH_P1);
+  if (len <= 16) {
+    if (len >= 4) {
+      size_t mid = (len >> 3) << 2;
+      a = hash_read32(p) << 32 | hash_read32(p + mid);
+      b = hash_read32(p + len - 4) << 32 | hash_read32(p + len - 4 - mid);
+    } else if (len > 0) {
+      a = (uint64_t)p[0] << 16 | (uint64_t)p[len >> 1] << 8 | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      uint64_t seed1 = seed, seed2 = seed;
+      do {
+        seed = hash_mum(hash_read64(p) ^ HASH_P1, hash_read64(p + 8) ^ seed);
+        seed1 = hash_mum(hash_read64(p + 16) ^ HASH_P2,
+                         hash_read64(p + 24) ^ seed1);
+        seed2 = hash_mum(hash_read64(p + 32) ^ HASH_P3,
+                         hash_read64(p + 40) ^ seed2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= seed1 ^ seed2;
+    }
+    while (i > 16) {
+      seed = hash_mum(hash_read64(p) ^ HASH_P1, hash_read64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = hash_read64(p + i - 16);
+    b = hash_read64(p + i - 8);
+  }
+  __uint128_t r = (__uint128_t)(a ^ HASH_P1) * (b ^ seed);
+  return hash_mum((uint64_t)r ^ HASH_P0 ^ len, (uint64_t)(r >> 64) ^ HASH_P1);
+}
+
+// strlen() is vectorised in the C library, so finding the length first and
+// then hashing whole words is faster than hashing a byte at a time.
+static inline uint64_t
+hash_str(char const *key)
+{
+  return hash_bytes(key, strlen(key), 0);
+}
+
+static inline uint64_t
+hash_str_seeded(char const *key, uint64_t seed)
+{
+  return hash_bytes(key, strlen(key), seed);
+}
+
+// Key type functions
+
+static inline uint64_t
+hash_u32_key(void const *key)
+{
+  return hash_u32(*(uint32_t const *)key);
+}
+
+static inline uint64_t
+hash_u32_seeded_key(void const *key, uint64_t seed)
+{
+  return hash_u32_seeded(*(uint32_t const *)key, seed);
+}
+
+static inline uint64_t
+hash_u64_key(void const *key)
+{
+  return hash_u64(*(uint64_t const *)key);
+}
+
+static inline uint64_t
+hash_u64_seeded_key(void const *key, uint64_t seed)
+{
+  return hash_u64_seeded(*(uint64_t const *)key, seed);
+}
+
+static inline uint64_t
+hash_str_key(void const *key)
+{
+  return hash_str(key);
+}
+
+static inline uint64_t
+hash_str_seeded_key(void const *key, uint64_t seed)
+{
+  return hash_str_seeded(key, seed);
+}
+
+// A seed nobody can guess, so they can't pick keys that all collide.
+static inline uint64_t
+hash_random_seed(void)
+{
+  uint64_t seed;
+  if (getentropy(&seed, sizeof seed) == 0)
+    return seed;
+
+  // Without an entropy source, the time and our address are better than
+  // nothing.
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  seed = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  return hash_mum(seed ^ HASH_P2, (uintptr_t)&seed ^ HASH_P3);
+}
+
+#endif
@@ -0,0 +1,1188 @@
+
+// Benchmark of the hash table implementations on parameterised workloads.
+//
+// Each configuration first builds a set of `size` keys and then runs a stream
+// of operations against it. An operation is an update (delete a present key
+// and insert a new one) with probability `update`, and otherwise a lookup
+// that finds its key with probability `hit`. The keys we look up are drawn
+// uniformly or from a Zipf distribution over the present keys. The operations
+// are generated before we start the clock, so we only time the tables.
+//
+// The memory a configuration reports is the heap its table holds, counted by
+// malloc: the bytes allocated on top of the workload after the build or after
+// the operations, whichever is more. The old and new bins a table holds for a
+// moment while it resizes are not counted, so the true peak can be higher.
+// Every configuration runs in its own process, so it starts with a fresh heap.
+
+#include "generated_hash_set.h"
+#include "generated_inline_hash_set.h"
+#include "generated_oa_map.h"
+#include "hash.h"
+#include "hash_bench.h"
+#include "open_addressing_map.h"
+
+#include <getopt.h>
+#include <malloc.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Hash functions //////////////////////////////////////////////////////////
+bool bench_weak_hash = false;
+
+uint64_t
+bench_u32_hash(uint32_t key)
+{
+  return bench_weak_hash ? key : hash_u32(key);
+}
+
+uint64_t
+bench_str_hash(char const *key)
+{
+  if (!bench_weak_hash)
+    return hash_str(key);
+  uint64_t hash = 0;
+  for (; *key; key++) {
+    hash = 31 * hash + (unsigned char)*key;
+  }
+  return hash;
+}
+
+// open_addressing_map //////////////////////////////////////////////////////
+static uint64_t
+oa_u32_hash(void const *key)
+{
+  return bench_u32_hash(*(uint32_t const *)key);
+}
+
+static bool
+oa_u32_cmp(void const *a, void const *b)
+{
+  return *(uint32_t const *)a == *(uint32_t const *)b;
+}
+
+static uint64_t
+oa_str_hash(void const *key)
+{
+  return bench_str_hash(key);
+}
+
+static bool
+oa_str_cmp(void const *a, void const *b)
+{
+  return strcmp(a, b) == 0;
+}
+
+static void *
+oa_str_dup(void const *key)
+{
+  char *copy = malloc(strlen(key) + 1);
+  strcpy(copy, key);
+  return copy;
+}
+
+static struct key_type const oa_u32_key_type = {
+    .hash = oa_u32_hash, .cmp = oa_u32_cmp, STORE_INLINE(uint32_t)};
+static struct key_type const oa_str_key_type = {
+    .hash = oa_str_hash, .cmp = oa_str_cmp, .cpy = oa_str_dup, .del = free};
+// The map is used as a set, so the values are just the smallest we can store.
+static struct value_type const oa_val_type = {STORE_INLINE(uint8_t)};
+static uint8_t const oa_val = 1;
+
+static void *
+new_oa_u32(void)
+{
+  return new_table(&oa_u32_key_type, &oa_val_type);
+}
+
+static void *
+new_oa_str(void)
+{
+  return new_table(&oa_str_key_type, &oa_val_type);
+}
+
+static void *
+new_oa_rh_u32(void)
+{
+  struct table_options options = {.robin_hood = true};
+  return new_table_with_options(&oa_u32_key_type, &oa_val_type, &options);
+}
+
+static void *
+new_oa_rh_str(void)
+{
+  struct table_options options = {.robin_hood = true};
+  return new_table_with_options(&oa_str_key_type, &oa_val_type, &options);
+}
+
+static void *
+new_oa_tri_u32(void)
+{
+  struct table_options options = {.probing = PROBE_TRIANGULAR};
+  return new_table_with_options(&oa_u32_key_type, &oa_val_type, &options);
+}
+
+static void *
+new_oa_tri_str(void)
+{
+  struct table_options options = {.probing = PROBE_TRIANGULAR};
+  return new_table_with_options(&oa_str_key_type, &oa_val_type, &options);
+}
+
+static void *
+new_oa_dh_u32(void)
+{
+  struct table_options options = {.probing = PROBE_DOUBLE_HASH};
+  return new_table_with_options(&oa_u32_key_type, &oa_val_type, &options);
+}
+
+static void *
+new_oa_dh_str(void)
+{
+  struct table_options options = {.probing = PROBE_DOUBLE_HASH};
+  return new_table_with_options(&oa_str_key_type, &oa_val_type, &options);
+}
+
+static void
+oa_insert(void *set, void const *key)
+{
+  add_map(set, key, &oa_val);
+}
+
+static bool
+oa_contains(void *set, void const *key)
+{
+  return lookup_key(set, key) != NULL;
+}
+
+static void
+oa_delete(void *set, void const *key)
+{
+  delete_key(set, key);
+}
+
+static void
+oa_free(void *set)
+{
+  delete_table(set);
+}
+
+static struct bench_impl const oa_u32_impl = {
+    .name = "oa_map",
+    .string_keys = false,
+    .new_set = new_oa_u32,
+    .insert = oa_insert,
+    .contains = oa_contains,
+    .delete = oa_delete,
+    .free_set = oa_free,
+};
+static struct bench_impl const oa_str_impl = {
+    .name = "oa_map",
+    .string_keys = true,
+    .new_set = new_oa_str,
+    .insert = oa_insert,
+    .contains = oa_contains,
+    .delete = oa_delete,
+    .free_set = oa_free,
+};
+static struct bench_impl const oa_rh_u32_impl = {
+    .name = "oa_map_robin_hood",
+    .string_keys = false,
+    .new_set = new_oa_rh_u32,
+    .insert = oa_insert,
+    .contains = oa_contains,
+    .delete = oa_delete,
+    .free_set = oa_free,
+};
+static struct bench_impl const oa_rh_str_impl = {
+    .name = "oa_map_robin_hood",
+    .string_keys = true,
+    .new_set = new_oa_rh_str,
+    .insert = oa_insert,
+    .contains = oa_contains,
+    .delete = oa_delete,
+    .free_set = oa_free,
+};
+static struct bench_impl const oa_tri_u32_impl = {
+    .name = "oa_map_triangular",
+    .string_keys = false,
+    .new_set = new_oa_tri_u32,
+    .insert = oa_insert,
+    .contains = oa_contains,
+    .delete = oa_delete,
+    .free_set = oa_free,
+};
+static struct bench_impl const oa_tri_str_impl = {
+    .name = "oa_map_triangular",
+    .string_keys = true,
+    .new_set = new_oa_tri_str,
+    .insert = oa_insert,
+    .contains = oa_contains,
+    .delete = oa_delete,
+    .free_set = oa_free,
+};
+static struct bench_impl const oa_dh_u32_impl = {
+    .name = "oa_map_double_hash",
+    .string_keys = false,
+    .new_set = new_oa_dh_u32,
+    .insert = oa_insert,
+    .contains = oa_contains,
+    .delete = oa_delete,
+    .free_set = oa_free,
+};
+static struct bench_impl const oa_dh_str_impl = {
+    .name = "oa_map_double_hash",
+    .string_keys = true,
+    .new_set = new_oa_dh_str,
+    .insert = oa_insert,
+    .contains = oa_contains,
+    .delete = oa_delete,
+    .free_set = oa_free,
+};
+
+// GEN_HASH_TABLE ///////////////////////////////////////////////////////////
+// Like the old set, the chained sets refer to the benchmark's keys instead of
+// owning copies of them.
+#define EQ_CMP(A, B) ((A) == (B))
+#define STR_CMP(A, B) (strcmp((A), (B)) == 0)
+#define NOP_DESTRUCTOR(KEY)
+
+GEN_HASH_TABLE(bench_u32_set, uint32_t, EQ_CMP, bench_u32_hash,
+               NOP_DESTRUCTOR)
+GEN_HASH_TABLE(bench_str_set, char *, STR_CMP, bench_str_hash,
+               NOP_DESTRUCTOR)
+
+static void *
+new_chained_u32(void)
+{
+  return bench_u32_set_new_table();
+}
+
+static void
+chained_u32_insert(void *set, void const *key)
+{
+  bench_u32_set_insert_key(set, *(uint32_t const *)key);
+}
+
+static bool
+chained_u32_contains(void *set, void const *key)
+{
+  return bench_u32_set_contains_key(set, *(uint32_t const *)key);
+}
+
+static void
+chained_u32_delete(void *set, void const *key)
+{
+  bench_u32_set_delete_key(set, *(uint32_t const *)key);
+}
+
+static void
+chained_u32_free(void *set)
+{
+  bench_u32_set_free_table(set);
+}
+
+static void *
+new_chained_str(void)
+{
+  return bench_str_set_new_table();
+}
+
+static void
+chained_str_insert(void *set, void const *key)
+{
+  bench_str_set_insert_key(set, (char *)key);
+}
+
+static bool
+chained_str_contains(void *set, void const *key)
+{
+  return bench_str_set_contains_key(set, (char *)key);
+}
+
+static void
+chained_str_delete(void *set, void const *key)
+{
+  bench_str_set_delete_key(set, (char *)key);
+}
+
+static void
+chained_str_free(void *set)
+{
+  bench_str_set_free_table(set);
+}
+
+static struct bench_impl const chained_u32_impl = {
+    .name = "chained_set",
+    .string_keys = false,
+    .new_set = new_chained_u32,
+    .insert = chained_u32_insert,
+    .contains = chained_u32_contains,
+    .delete = chained_u32_delete,
+    .free_set = chained_u32_free,
+};
+static struct bench_impl const chained_str_impl = {
+    .name = "chained_set",
+    .string_keys = true,
+    .new_set = new_chained_str,
+    .insert = chained_str_insert,
+    .contains = chained_str_contains,
+    .delete = chained_str_delete,
+    .free_set = chained_str_free,
+};
+
+// The same sets, with their links from a pool.
+static void *
+new_chained_pool_u32(void)
+{
+  return bench_u32_set_new_pooled_table();
+}
+
+static void *
+new_chained_pool_str(void)
+{
+  return bench_str_set_new_pooled_table();
+}
+
+static struct bench_impl const chained_pool_u32_impl = {
+    .name = "chained_set_pool",
+    .string_keys = false,
+    .new_set = new_chained_pool_u32,
+    .insert = chained_u32_insert,
+    .contains = chained_u32_contains,
+    .delete = chained_u32_delete,
+    .free_set = chained_u32_free,
+};
+static struct bench_impl const chained_pool_str_impl = {
+    .name = "chained_set_pool",
+    .string_keys = true,
+    .new_set = new_chained_pool_str,
+    .insert = chained_str_insert,
+    .contains = chained_str_contains,
+    .delete = chained_str_delete,
+    .free_set = chained_str_free,
+};
+
+// The string set again, with hash keys cached in the links.
+GEN_CACHED_HASH_TABLE(bench_cached_str_set, char *, STR_CMP, bench_str_hash,
+                      NOP_DESTRUCTOR)
+
+static void *
+new_chained_cached_str(void)
+{
+  return bench_cached_str_set_new_table();
+}
+
+static void
+chained_cached_str_insert(void *set, void const *key)
+{
+  bench_cached_str_set_insert_key(set, (char *)key);
+}
+
+static bool
+chained_cached_str_contains(void *set, void const *key)
+{
+  return bench_cached_str_set_contains_key(set, (char *)key);
+}
+
+static void
+chained_cached_str_delete(void *set, void const *key)
+{
+  bench_cached_str_set_delete_key(set, (char *)key);
+}
+
+static void
+chained_cached_str_free(void *set)
+{
+  bench_cached_str_set_free_table(set);
+}
+
+static struct bench_impl const chained_cached_str_impl = {
+    .name = "chained_set_cached",
+    .string_keys = true,
+    .new_set = new_chained_cached_str,
+    .insert = chained_cached_str_insert,
+    .contains = chained_cached_str_contains,
+    .delete = chained_cached_str_delete,
+    .free_set = chained_cached_str_free,
+};
+
+// The sets again, with unrolled lists in the bins.
+GEN_UNROLLED_HASH_TABLE(bench_u32_unrolled, uint32_t, EQ_CMP, bench_u32_hash,
+                        NOP_DESTRUCTOR)
+GEN_UNROLLED_HASH_TABLE(bench_str_unrolled, char *, STR_CMP, bench_str_hash,
+                        NOP_DESTRUCTOR)
+
+static void *
+new_unrolled_u32(void)
+{
+  return bench_u32_unrolled_new_table();
+}
+
+static void
+unrolled_u32_insert(void *set, void const *key)
+{
+  bench_u32_unrolled_insert_key(set, *(uint32_t const *)key);
+}
+
+static bool
+unrolled_u32_contains(void *set, void const *key)
+{
+  return bench_u32_unrolled_contains_key(set, *(uint32_t const *)key);
+}
+
+static void
+unrolled_u32_delete(void *set, void const *key)
+{
+  bench_u32_unrolled_delete_key(set, *(uint32_t const *)key);
+}
+
+static void
+unrolled_u32_free(void *set)
+{
+  bench_u32_unrolled_free_table(set);
+}
+
+static void *
+new_unrolled_str(void)
+{
+  return bench_str_unrolled_new_table();
+}
+
+static void
+unrolled_str_insert(void *set, void const *key)
+{
+  bench_str_unrolled_insert_key(set, (char *)key);
+}
+
+static bool
+unrolled_str_contains(void *set, void const *key)
+{
+  return bench_str_unrolled_contains_key(set, (char *)key);
+}
+
+static void
+unrolled_str_delete(void *set, void const *key)
+{
+  bench_str_unrolled_delete_key(set, (char *)key);
+}
+
+static void
+unrolled_str_free(void *set)
+{
+  bench_str_unrolled_free_table(set);
+}
+
+static struct bench_impl const unrolled_u32_impl = {
+    .name = "chained_set_unrolled",
+    .string_keys = false,
+    .new_set = new_unrolled_u32,
+    .insert = unrolled_u32_insert,
+    .contains = unrolled_u32_contains,
+    .delete = unrolled_u32_delete,
+    .free_set = unrolled_u32_free,
+};
+static struct bench_impl const unrolled_str_impl = {
+    .name = "chained_set_unrolled",
+    .string_keys = true,
+    .new_set = new_unrolled_str,
+    .insert = unrolled_str_insert,
+    .contains = unrolled_str_contains,
+    .delete = unrolled_str_delete,
+    .free_set = unrolled_str_free,
+};
+
+// GEN_INLINE_HASH_TABLE ////////////////////////////////////////////////////
+GEN_INLINE_HASH_TABLE(bench_u32_inline, uint32_t, EQ_CMP, bench_u32_hash,
+                      NOP_DESTRUCTOR)
+GEN_INLINE_HASH_TABLE(bench_str_inline, char *, STR_CMP, bench_str_hash,
+                      NOP_DESTRUCTOR)
+
+static void *
+new_inline_u32(void)
+{
+  return bench_u32_inline_new_table();
+}
+
+static void
+inline_u32_insert(void *set, void const *key)
+{
+  bench_u32_inline_insert_key(set, *(uint32_t const *)key);
+}
+
+static bool
+inline_u32_contains(void *set, void const *key)
+{
+  return bench_u32_inline_contains_key(set, *(uint32_t const *)key);
+}
+
+static void
+inline_u32_delete(void *set, void const *key)
+{
+  bench_u32_inline_delete_key(set, *(uint32_t const *)key);
+}
+
+static void
+inline_u32_free(void *set)
+{
+  bench_u32_inline_free_table(set);
+}
+
+static void *
+new_inline_str(void)
+{
+  return bench_str_inline_new_table();
+}
+
+static void
+inline_str_insert(void *set, void const *key)
+{
+  bench_str_inline_insert_key(set, (char *)key);
+}
+
+static bool
+inline_str_contains(void *set, void const *key)
+{
+  return bench_str_inline_contains_key(set, (char *)key);
+}
+
+static void
+inline_str_delete(void *set, void const *key)
+{
+  bench_str_inline_delete_key(set, (char *)key);
+}
+
+static void
+inline_str_free(void *set)
+{
+  bench_str_inline_free_table(set);
+}
+
+static struct bench_impl const inline_u32_impl = {
+    .name = "chained_set_inline",
+    .string_keys = false,
+    .new_set = new_inline_u32,
+    .insert = inline_u32_insert,
+    .contains = inline_u32_contains,
+    .delete = inline_u32_delete,
+    .free_set = inline_u32_free,
+};
+static struct bench_impl const inline_str_impl = {
+    .name = "chained_set_inline",
+    .string_keys = true,
+    .new_set = new_inline_str,
+    .insert = inline_str_insert,
+    .contains = inline_str_contains,
+    .delete = inline_str_delete,
+    .free_set = inline_str_free,
+};
+
+// GEN_OA_MAP ///////////////////////////////////////////////////////////////
+// Also refers to the benchmark's keys, and stores the same one-byte values as
+// oa_map.
+GEN_OA_MAP(bench_u32_map, uint32_t, uint8_t, bench_u32_hash, EQ_CMP,
+           NOP_DESTRUCTOR, NOP_DESTRUCTOR)
+GEN_OA_MAP(bench_str_map, char *, uint8_t, bench_str_hash, STR_CMP,
+           NOP_DESTRUCTOR, NOP_DESTRUCTOR)
+
+static void *
+new_gen_oa_u32(void)
+{
+  return bench_u32_map_new_table();
+}
+
+static void
+gen_oa_u32_insert(void *set, void const *key)
+{
+  bench_u32_map_add_map(set, *(uint32_t const *)key, oa_val);
+}
+
+static bool
+gen_oa_u32_contains(void *set, void const *key)
+{
+  return bench_u32_map_lookup_key(set, *(uint32_t const *)key) != NULL;
+}
+
+static void
+gen_oa_u32_delete(void *set, void const *key)
+{
+  bench_u32_map_delete_key(set, *(uint32_t const *)key);
+}
+
+static void
+gen_oa_u32_free(void *set)
+{
+  bench_u32_map_free_table(set);
+}
+
+static void *
+new_gen_oa_str(void)
+{
+  return bench_str_map_new_table();
+}
+
+static void
+gen_oa_str_insert(void *set, void const *key)
+{
+  bench_str_map_add_map(set, (char *)key, oa_val);
+}
+
+static bool
+gen_oa_str_contains(void *set, void const *key)
+{
+  return bench_str_map_lookup_key(set, (char *)key) != NULL;
+}
+
+static void
+gen_oa_str_delete(void *set, void const *key)
+{
+  bench_str_map_delete_key(set, (char *)key);
+}
+
+static void
+gen_oa_str_free(void *set)
+{
+  bench_str_map_free_table(set);
+}
+
+static struct bench_impl const gen_oa_u32_impl = {
+    .name = "generated_oa_map",
+    .string_keys = false,
+    .new_set = new_gen_oa_u32,
+    .insert = gen_oa_u32_insert,
+    .contains = gen_oa_u32_contains,
+    .delete = gen_oa_u32_delete,
+    .free_set = gen_oa_u32_free,
+};
+static struct bench_impl const gen_oa_str_impl = {
+    .name = "generated_oa_map",
+    .string_keys = true,
+    .new_set = new_gen_oa_str,
+    .insert = gen_oa_str_insert,
+    .contains = gen_oa_str_contains,
+    .delete = gen_oa_str_delete,
+    .free_set = gen_oa_str_free,
+};
+
+static struct bench_impl const *const impls[] = {
+    &oa_u32_impl,           &oa_str_impl,           &oa_rh_u32_impl,
+    &oa_rh_str_impl,        &oa_tri_u32_impl,       &oa_tri_str_impl,
+    &oa_dh_u32_impl,        &oa_dh_str_impl,        &gen_oa_u32_impl,
+    &gen_oa_str_impl,       &chained_u32_impl,      &chained_str_impl,
+    &chained_pool_u32_impl, &chained_pool_str_impl, &chained_cached_str_impl,
+    &unrolled_u32_impl,     &unrolled_str_impl,     &inline_u32_impl,
+    &inline_str_impl,       &old_set_u32_impl,      &old_set_str_impl,
+};
+#define NO_IMPLS (sizeof impls / sizeof *impls)
+
+// Workloads ////////////////////////////////////////////////////////////////
+enum dist { UNIFORM, ZIPF };
+static char const *const dist_names[] = {"uniform", "zipf"};
+
+struct config {
+  struct bench_impl const *impl;
+  enum dist dist;
+  size_t size;
+  double hit;
+  double update;
+  size_t no_ops;
+  double zipf_s;
+};
+
+// An operation looks up `key`, or, if it is an update, deletes `key` and
+// inserts `fresh`. Keys are indices into the workload's key array.
+struct op {
+  uint32_t key;
+  uint32_t fresh;
+  bool update;
+};
+
+struct workload {
+  uint32_t *int_keys;
+  char **str_keys;
+  void const **keys; // pointers to the keys the implementation takes
+  size_t no_keys;
+  struct op *ops;
+  size_t expected_hits;
+};
+
+// splitmix64, so the workloads are the same on all platforms.
+static uint64_t
+next_random(uint64_t *state)
+{
+  uint64_t z = (*state += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+static double
+random_unit(uint64_t *state)
+{
+  return (next_random(state) >> 11) * 0x1.0p-53;
+}
+
+static size_t
+random_below(uint64_t *state, size_t n)
+{
+  return (size_t)(random_unit(state) * n);
+}
+
+// Index of the first entry in the cumulative distribution that is at least u.
+static size_t
+sample_cdf(double const *cdf, size_t n, double u)
+{
+  size_t lo = 0, hi = n - 1;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (cdf[mid] < u)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// A bijection on 32-bit integers (the murmur3 finaliser), so the keys made
+// from different indices are different.
+static uint32_t
+scramble(uint32_t i)
+{
+  i ^= i >> 16;
+  i *= 0x85ebca6b;
+  i ^= i >> 13;
+  i *= 0xc2b2ae35;
+  i ^= i >> 16;
+  return i;
+}
+
+// Keys [0, size) start out in the set, updates insert keys from
+// [size, size + no_ops), and misses look up keys from the rest, which are
+// never inserted. The keys are a bijection of their indices, so they are
+// all different, but their order doesn't follow the indices. With weak
+// hashing, integer keys are instead multiples of 64, like aligned pointers,
+// so their identity hashes cluster.
+static void
+make_workload(struct config const *config, struct workload *w)
+{
+  size_t size = config->size, no_ops = config->no_ops;
+  size_t no_misses = size > 0 ? size : 1;
+  w->no_keys = size + no_ops + no_misses;
+  w->int_keys = malloc(w->no_keys * sizeof *w->int_keys);
+  w->str_keys = NULL;
+  w->keys = malloc(w->no_keys * sizeof *w->keys);
+  for (size_t i = 0; i < w->no_keys; i++) {
+    w->int_keys[i] = bench_weak_hash ? (uint32_t)i * 64 : scramble((uint32_t)i);
+    w->keys[i] = &w->int_keys[i];
+  }
+  if (config->impl->string_keys) {
+    w->str_keys = malloc(w->no_keys * sizeof *w->str_keys);
+    for (size_t i = 0; i < w->no_keys; i++) {
+      w->str_keys[i] = malloc(11);
+      sprintf(w->str_keys[i], "%u", w->int_keys[i]);
+      w->keys[i] = w->str_keys[i];
+    }
+  }
+
+  // The Zipf distribution ranks the positions in `present`, so the popular
+  // keys change when updates replace them.
+  double *cdf = NULL;
+  if (config->dist == ZIPF && size > 0) {
+    cdf = malloc(size * sizeof *cdf);
+    double total = 0.0;
+    for (size_t i = 0; i < size; i++) {
+      total += 1.0 / pow((double)(i + 1), config->zipf_s);
+      cdf[i] = total;
+    }
+    for (size_t i = 0; i < size; i++) {
+      cdf[i] /= total;
+    }
+  }
+
+  uint32_t *present = malloc((size + 1) * sizeof *present);
+  for (size_t i = 0; i < size; i++) {
+    present[i] = (uint32_t)i;
+  }
+  uint32_t next_fresh = (uint32_t)size;
+  uint32_t first_miss = (uint32_t)(size + no_ops);
+
+  uint64_t state = 42;
+  w->ops = malloc(no_ops * sizeof *w->ops);
+  w->expected_hits = 0;
+  for (size_t i = 0; i < no_ops; i++) {
+    struct op *op = &w->ops[i];
+    if (size > 0 && random_unit(&state) < config->update) {
+      size_t pos = random_below(&state, size);
+      *op = (struct op){
+          .key = present[pos], .fresh = next_fresh, .update = true};
+      present[pos] = next_fresh++;
+    } else if (size > 0 && random_unit(&state) < config->hit) {
+      size_t pos = cdf ? sample_cdf(cdf, size, random_unit(&state))
+                       : random_below(&state, size);
+      *op = (struct op){.key = present[pos], .update = false};
+      w->expected_hits++;
+    } else {
+      size_t miss = random_below(&state, no_misses);
+      *op = (struct op){.key = first_miss + (uint32_t)miss, .update = false};
+    }
+  }
+
+  free(present);
+  free(cdf);
+}
+
+static void
+free_workload(struct workload *w)
+{
+  if (w->str_keys) {
+    for (size_t i = 0; i < w->no_keys; i++) {
+      free(w->str_keys[i]);
+    }
+    free(w->str_keys);
+  }
+  free(w->int_keys);
+  free(w->keys);
+  free(w->ops);
+}
+
+// Running the benchmarks ///////////////////////////////////////////////////
+enum format { CSV, JSON };
+
+static double
+now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Bytes allocated with malloc and not yet freed, including large blocks
+// malloc gets with mmap.
+static size_t
+heap_in_use(void)
+{
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+static void
+run_config(struct config const *config, enum format format)
+{
+  struct bench_impl const *impl = config->impl;
+  struct workload w;
+  make_workload(config, &w);
+  size_t base = heap_in_use();
+
+  void *set = impl->new_set();
+  double start = now_ns();
+  for (size_t i = 0; i < config->size; i++) {
+    impl->insert(set, w.keys[i]);
+  }
+  double build_ns = now_ns() - start;
+  size_t table_bytes = heap_in_use() - base;
+
+  size_t hits = 0;
+  start = now_ns();
+  for (size_t i = 0; i < config->no_ops; i++) {
+    struct op const *op = &w.ops[i];
+    if (op->update) {
+      impl->delete(set, w.keys[op->key]);
+      impl->insert(set, w.keys[op->fresh]);
+    } else {
+      hits += impl->contains(set, w.keys[op->key]);
+    }
+  }
+  double ops_ns = now_ns() - start;
+  if (heap_in_use() - base > table_bytes)
+    table_bytes = heap_in_use() - base;
+  size_t table_kb = (table_bytes + 1023) / 1024;
+
+  // Checking the hits also keeps the compiler from dropping the lookups.
+  if (hits != w.expected_hits) {
+    fprintf(stderr, "%s: expected %zu hits but got %zu\n", impl->name,
+            w.expected_hits, hits);
+    exit(EXIT_FAILURE);
+  }
+
+  impl->free_set(set);
+  free_workload(&w);
+
+  double build_per_insert = config->size ? build_ns / config->size : 0.0;
+  double per_op = config->no_ops ? ops_ns / config->no_ops : 0.0;
+  char const *keys = impl->string_keys ? "str" : "int";
+  char const *dist = dist_names[config->dist];
+  char const *hash = bench_weak_hash ? "weak" : "mixed";
+  if (format == CSV) {
+    printf("%s,%s,%s,%s,%zu,%g,%g,%.2f,%.2f,%zu\n", impl->name, keys, hash,
+           dist, config->size, config->hit, config->update, build_per_insert,
+           per_op, table_kb);
+  } else {
+    printf("  {\"impl\": \"%s\", \"keys\": \"%s\", \"hash\": \"%s\", "
+           "\"dist\": \"%s\", \"size\": %zu, \"hit_ratio\": %g, "
+           "\"update_ratio\": %g, \"build_ns_per_insert\": %.2f, "
+           "\"ns_per_op\": %.2f, \"table_kb\": %zu}",
+           impl->name, keys, hash, dist, config->size, config->hit,
+           config->update, build_per_insert, per_op, table_kb);
+  }
+}
+
+// Run the configuration in a child process, so it starts with a fresh heap
+// and its memory isn't mixed up with what earlier runs left behind.
+static bool
+run_isolated(struct config const *config, enum format format)
+{
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  }
+  if (pid == 0) {
+    run_config(config, format);
+    fflush(stdout);
+    _exit(EXIT_SUCCESS);
+  }
+  int status;
+  if (waitpid(pid, &status, 0) < 0) {
+    perror("waitpid");
+    return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+// Command line /////////////////////////////////////////////////////////////
+#define MAX_VALUES 32
+
+struct options {
+  size_t sizes[MAX_VALUES];
+  int no_sizes;
+  double hits[MAX_VALUES];
+  int no_hits;
+  double updates[MAX_VALUES];
+  int no_updates;
+  bool dists[2];
+  bool int_keys, str_keys;
+  char const *impls; // comma separated names, or NULL for all
+  size_t no_ops;
+  double zipf_s;
+  enum format format;
+};
+
+// Split a comma separated list in place, and return the number of items.
+static int
+split_list(char *list, char *items[])
+{
+  int n = 0;
+  for (char *item = strtok(list, ","); item; item = strtok(NULL, ",")) {
+    if (n == MAX_VALUES) {
+      fprintf(stderr, "too many values in a list (max %d)\n", MAX_VALUES);
+      exit(EXIT_FAILURE);
+    }
+    items[n++] = item;
+  }
+  return n;
+}
+
+static int
+parse_sizes(char *arg, size_t sizes[])
+{
+  char *items[MAX_VALUES];
+  int n = split_list(arg, items);
+  for (int i = 0; i < n; i++) {
+    sizes[i] = strtoul(items[i], NULL, 10);
+  }
+  return n;
+}
+
+static int
+parse_ratios(char *arg, double ratios[])
+{
+  char *items[MAX_VALUES];
+  int n = split_list(arg, items);
+  for (int i = 0; i < n; i++) {
+    ratios[i] = strtod(items[i], NULL);
+    if (ratios[i] < 0.0 || ratios[i] > 1.0) {
+      fprintf(stderr, "ratio %s is not between 0 and 1\n", items[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  return n;
+}
+
+static void
+parse_names(char *arg, char const *const names[], bool selected[], int n)
+{
+  char *items[MAX_VALUES];
+  int no_items = split_list(arg, items);
+  for (int i = 0; i < n; i++) {
+    selected[i] = false;
+  }
+  for (int i = 0; i < no_items; i++) {
+    int j = 0;
+    while (j < n && strcmp(items[i], names[j]) != 0)
+      j++;
+    if (j == n) {
+      fprintf(stderr, "unknown value '%s'\n", items[i]);
+      exit(EXIT_FAILURE);
+    }
+    selected[j] = true;
+  }
+}
+
+static bool
+impl_selected(char const *impls, char const *name)
+{
+  if (!impls)
+    return true;
+  size_t len = strlen(name);
+  for (char const *p = impls; p; p = strchr(p, ',')) {
+    if (*p == ',')
+      p++;
+    if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0'))
+      return true;
+  }
+  return false;
+}
+
+static void
+usage(char const *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -n SIZES    keys in the table (default 1000,1000000)\n"
+          "  -h RATIOS   fraction of lookups that hit (default 0.9,0.1)\n"
+          "  -u RATIOS   fraction of operations that update (default 0,0.5)\n"
+          "  -d DISTS    uniform and/or zipf (default uniform,zipf)\n"
+          "  -k KEYS     int and/or str (default int,str)\n"
+          "  -i IMPLS    oa_map, oa_map_robin_hood, oa_map_triangular,\n"
+          "              oa_map_double_hash, generated_oa_map, chained_set,\n"
+          "              chained_set_pool, chained_set_cached (str only),\n"
+          "              chained_set_inline, chained_set_unrolled,\n"
+          "              old_set\n"
+          "              (default all)\n"
+          "  -w          weak hash functions, and int keys that cluster\n"
+          "  -o OPS      operations per run (default 1000000)\n"
+          "  -s EXPONENT exponent of the Zipf distribution (default 0.99)\n"
+          "  -f FORMAT   csv or json (default csv)\n",
+          prog);
+}
+
+static void
+parse_options(int argc, char **argv, struct options *options)
+{
+  char default_sizes[] = "1000,1000000";
+  char default_hits[] = "0.9,0.1";
+  char default_updates[] = "0,0.5";
+  *options = (struct options){
+      .dists = {true, true},
+      .int_keys = true,
+      .str_keys = true,
+      .impls = NULL,
+      .no_ops = 1000000,
+      .zipf_s = 0.99,
+      .format = CSV,
+  };
+  options->no_sizes = parse_sizes(default_sizes, options->sizes);
+  options->no_hits = parse_ratios(default_hits, options->hits);
+  options->no_updates = parse_ratios(default_updates, options->updates);
+
+  static char const *const key_names[] = {"int", "str"};
+  static char const *const format_names[] = {"csv", "json"};
+  bool keys[2], formats[2];
+  int opt;
+  while ((opt = getopt(argc, argv, "n:h:u:d:k:i:o:s:f:w")) != -1) {
+    switch (opt) {
+    case 'n':
+      options->no_sizes = parse_sizes(optarg, options->sizes);
+      break;
+    case 'h':
+      options->no_hits = parse_ratios(optarg, options->hits);
+      break;
+    case 'u':
+      options->no_updates = parse_ratios(optarg, options->updates);
+      break;
+    case 'd':
+      parse_names(optarg, dist_names, options->dists, 2);
+      break;
+    case 'k':
+      parse_names(optarg, key_names, keys, 2);
+      options->int_keys = keys[0];
+      options->str_keys = keys[1];
+      break;
+    case 'i':
+      options->impls = optarg;
+      break;
+    case 'o':
+      options->no_ops = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      options->zipf_s = strtod(optarg, NULL);
+      break;
+    case 'w':
+      bench_weak_hash = true;
+      break;
+    case 'f':
+      parse_names(optarg, format_names, formats, 2);
+      options->format = formats[1] ? JSON : CSV;
+      break;
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+int
+main(int argc, char **argv)
+{
+  struct options options;
+  parse_options(argc, argv, &options);
+
+  if (options.format == CSV) {
+    printf("impl,keys,hash,dist,size,hit_ratio,update_ratio,"
+           "build_ns_per_insert,ns_per_op,table_kb\n");
+  } else {
+    printf("[\n");
+  }
+
+  bool first = true, ok = true;
+  for (size_t i = 0; i < NO_IMPLS; i++) {
+    struct bench_impl const *impl = impls[i];
+    if (!impl_selected(options.impls, impl->name))
+      continue;
+    if (impl->string_keys ? !options.str_keys : !options.int_keys)
+      continue;
+    for (int d = 0; d < 2; d++) {
+      if (!options.dists[d])
+        continue;
+      for (int n = 0; n < options.no_sizes; n++) {
+        for (int h = 0; h < options.no_hits; h++) {
+          for (int u = 0; u < options.no_updates; u++) {
+            struct config config = {
+                .impl = impl,
+                .dist = (enum dist)d,
+                .size = options.sizes[n],
+                .hit = options.hits[h],
+                .update = options.updates[u],
+                .no_ops = options.no_ops,
+                .zipf_s = options.zipf_s,
+            };
+            if (options.format == JSON && !first)
+              printf(",\n");
+            first = false;
+            ok &= run_isolated(&config, options.format);
+          }
+        }
+      }
+    }
+  }
+
+  if (options.format == JSON) {
+    printf("\n]\n");
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
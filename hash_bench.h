@@ -0,0 +1,34 @@
+
+#ifndef HASH_BENCH_H
+#define HASH_BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A set implementation we can benchmark. Integer keys are passed as pointers
+// to uint32_t and string keys as char pointers. The benchmark never inserts a
+// key that is already in the set or deletes one that isn't.
+struct bench_impl {
+  char const *name;
+  bool string_keys;
+  void *(*new_set)(void);
+  void (*insert)(void *set, void const *key);
+  bool (*contains)(void *set, void const *key);
+  void (*delete)(void *set, void const *key);
+  void (*free_set)(void *set);
+};
+
+// The hash function all implementations use, so they are compared on equal
+// terms. With weak hashing, integers hash to themselves and strings get a
+// simple multiplicative hash, to see how the tables cope with clustering.
+extern bool bench_weak_hash;
+uint64_t
+bench_u32_hash(uint32_t key);
+uint64_t
+bench_str_hash(char const *key);
+
+// Implementations in other translation units
+extern struct bench_impl const old_set_u32_impl;
+extern struct bench_impl const old_set_str_impl;
+
+#endif
@@ -0,0 +1,101 @@
+
+// The old open addressing set uses the same names as open_addressing_map, so
+// we compile it in its own translation unit with its names changed.
+#define hash_table old_hash_table
+#define bin old_bin
+#define empty_table old_empty_table
+#define delete_table old_delete_table
+#define insert_key old_insert_key
+#define contains_key old_contains_key
+#define delete_key old_delete_key
+#include "old/open_addressing_set.c"
+
+#include "hash_bench.h"
+#include <string.h>
+
+// The old set doesn't own its keys, so we store the benchmark's pointers.
+static bool
+u32_cmp(void *a, void *b)
+{
+  return *(uint32_t *)a == *(uint32_t *)b;
+}
+
+static bool
+str_cmp(void *a, void *b)
+{
+  return strcmp(a, b) == 0;
+}
+
+static void *
+new_u32_set(void)
+{
+  return old_empty_table(8, u32_cmp, NULL);
+}
+
+static void *
+new_str_set(void)
+{
+  return old_empty_table(8, str_cmp, NULL);
+}
+
+static void
+u32_insert(void *set, void const *key)
+{
+  old_insert_key(set, bench_u32_hash(*(uint32_t *)key), (void *)key);
+}
+
+static bool
+u32_contains(void *set, void const *key)
+{
+  return old_contains_key(set, bench_u32_hash(*(uint32_t *)key), (void *)key);
+}
+
+static void
+u32_delete(void *set, void const *key)
+{
+  old_delete_key(set, bench_u32_hash(*(uint32_t *)key), (void *)key);
+}
+
+static void
+str_insert(void *set, void const *key)
+{
+  old_insert_key(set, bench_str_hash(key), (void *)key);
+}
+
+static bool
+str_contains(void *set, void const *key)
+{
+  return old_contains_key(set, bench_str_hash(key), (void *)key);
+}
+
+static void
+str_delete(void *set, void const *key)
+{
+  old_delete_key(set, bench_str_hash(key), (void *)key);
+}
+
+static void
+free_set(void *set)
+{
+  old_delete_table(set);
+}
+
+struct bench_impl const old_set_u32_impl = {
+    .name = "old_set",
+    .string_keys = false,
+    .new_set = new_u32_set,
+    .insert = u32_insert,
+    .contains = u32_contains,
+    .delete = u32_delete,
+    .free_set = free_set,
+};
+
+struct bench_impl const old_set_str_impl = {
+    .name = "old_set",
+    .string_keys = true,
+    .new_set = new_str_set,
+    .insert = str_insert,
+    .contains = str_contains,
+    .delete = str_delete,
+    .free_set = free_set,
+};
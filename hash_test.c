@@ -0,0 +1,115 @@
+
+#include "hash.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Hash buffers of every length up to no_elms, each in an allocation of
+// exactly that size so a sanitizer catches reads past the end. None of them
+// should collide, and the seed should change all of them.
+static void
+test_lengths(int no_elms)
+{
+  uint64_t *hashes = malloc((no_elms + 1) * sizeof *hashes);
+  for (int len = 0; len <= no_elms; ++len) {
+    uint8_t *buf = malloc(len ? len : 1);
+    for (int i = 0; i < len; ++i) {
+      buf[i] = (uint8_t)(7 * i + 1);
+    }
+    hashes[len] = hash_bytes(buf, len, 0);
+    assert(hashes[len] == hash_bytes(buf, len, 0));
+    assert(hashes[len] != hash_bytes(buf, len, 1));
+    free(buf);
+  }
+  for (int i = 0; i <= no_elms; ++i) {
+    for (int j = 0; j < i; ++j) {
+      assert(hashes[i] != hashes[j]);
+    }
+  }
+  free(hashes);
+}
+
+// Flipping one bit of the input should flip about half of the output bits.
+static void
+test_avalanche(void)
+{
+  uint8_t buf[64];
+  for (int i = 0; i < sizeof buf; ++i) {
+    buf[i] = (uint8_t)random();
+  }
+  for (int len = 1; len <= sizeof buf; len *= 2) {
+    uint64_t h = hash_bytes(buf, len, 0);
+    unsigned long flipped = 0;
+    for (int bit = 0; bit < 8 * len; ++bit) {
+      buf[bit / 8] ^= 1 << (bit % 8);
+      flipped += __builtin_popcountll(h ^ hash_bytes(buf, len, 0));
+      buf[bit / 8] ^= 1 << (bit % 8);
+    }
+    double mean = (double)flipped / (8 * len);
+    assert(28.0 < mean && mean < 36.0);
+  }
+
+  unsigned long flipped = 0;
+  for (uint32_t key = 0; key < 1000; ++key) {
+    for (int bit = 0; bit < 32; ++bit) {
+      uint64_t h = hash_u32(key) ^ hash_u32(key ^ 1u << bit);
+      flipped += __builtin_popcountll(h);
+    }
+  }
+  double mean = flipped / (1000.0 * 32);
+  assert(31.0 < mean && mean < 33.0);
+}
+
+// Sequential keys should spread over both the low bits that pick a bin and
+// the high bits the control bytes hold.
+static void
+test_sequential(int no_elms)
+{
+  unsigned int size = 1;
+  while (size < 2 * no_elms)
+    size *= 2;
+  unsigned int *low = calloc(size, sizeof *low);
+  unsigned int high[128] = {0};
+  for (uint32_t key = 0; key < no_elms; ++key) {
+    low[hash_u32(key) & (size - 1)]++;
+    high[hash_u32(key) >> 57]++;
+  }
+  for (unsigned int i = 0; i < size; ++i) {
+    assert(low[i] < 16);
+  }
+  for (unsigned int i = 0; i < 128; ++i) {
+    assert(high[i] < 2 * (no_elms / 128) + 8);
+  }
+  free(low);
+}
+
+static void
+test_strings(void)
+{
+  assert(hash_str("foo") == hash_str_key("foo"));
+  assert(hash_str("foo") != hash_str("bar"));
+  assert(hash_str("foo") != hash_str("foo "));
+  assert(hash_str("foo") == hash_str_seeded("foo", 0));
+  assert(hash_str_seeded("foo", 1) != hash_str_seeded("foo", 2));
+  assert(hash_u32_key(&(uint32_t){42}) == hash_u32(42));
+  assert(hash_u32_seeded(42, 1) != hash_u32_seeded(42, 2));
+  assert(hash_random_seed() != hash_random_seed());
+}
+
+int
+main(int argc, const char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: %s no_elements\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  int no_elms = atoi(argv[1]);
+  test_lengths(no_elms);
+  test_avalanche();
+  test_sequential(no_elms);
+  test_strings();
+
+  return EXIT_SUCCESS;
+}
@@ -1,244 +1,1508 @@
 
 #include "open_addressing_map.h"
+#include "control_bytes.h"
+#include "hash.h"
 #include <assert.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
-// Probing
-unsigned int static p(unsigned int k, unsigned int i, unsigned int m)
+// Probing. We probe a group at a time, and the i'th group in the probe for
+// hash key k starts at bin p(table, k, i). The groups are GROUP_WIDTH bins
+// apart, so with power-of-two table sizes, probing any odd number of groups
+// ahead, or ahead by triangular numbers of groups, eventually covers all bins.
+static inline size_t
+p(struct hash_table *table, uint64_t k, size_t i)
 {
-  return (k + i) & (m - 1);
+  size_t step;
+  switch (table->options.probing) {
+  case PROBE_TRIANGULAR:
+    step = (uint64_t)i * (i + 1) / 2;
+    break;
+  case PROBE_DOUBLE_HASH:
+    // All the bits of the hash key pick the stride, not just the ones that
+    // pick the home bin.
+    step = i * (((k * 0x9e3779b97f4a7c15) >> 32) | 1);
+    break;
+  default:
+    step = i;
+  }
+  return (k + step * GROUP_WIDTH) & (table->size - 1);
+}
+
+// The index of the first group in the probe for hash_key that bin i is in,
+// the group where find_key() will see it.
+static size_t
+probe_index(struct hash_table *table, uint64_t hash_key, size_t i)
+{
+  size_t mask = table->size - 1;
+  for (size_t j = 0; j < no_groups(table->size); j++) {
+    // Groups are loaded through the mirror, so they can wrap around
+    if (((i - p(table, hash_key, j)) & mask) < GROUP_WIDTH)
+      return j;
+  }
+  abort(); // We should never get here
+}
+
+// Statistics counters on the lookup path are compiled out unless we ask for
+// them.
+#ifdef OA_MAP_STATS
+#define COUNT(TABLE, COUNTER, N) ((TABLE)->counters.COUNTER += (N))
+#else
+#define COUNT(TABLE, COUNTER, N) ((void)0)
+#endif
+
+static double
+now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+add_counters(struct table_counters *to, struct table_counters const *from)
+{
+  to->finds += from->finds;
+  to->probed_groups += from->probed_groups;
+  to->compares += from->compares;
+  to->resizes += from->resizes;
+  to->purges += from->purges;
+  to->resize_seconds += from->resize_seconds;
 }
 
 // Helpers
-static inline unsigned int
+static inline uint64_t
 hash(struct hash_table *table, void const *key)
 {
-  return table->key_type->hash(key);
+  struct key_type const *kt = table->key_type;
+  return kt->seeded_hash ? kt->seeded_hash(key, table->seed) : kt->hash(key);
+}
+
+static inline struct bin *
+bin_at(struct hash_table *table, size_t i)
+{
+  return (struct bin *)(table->bins + i * table->bin_size);
+}
+
+// Where in the bin the key and value are stored. For inline types this is the
+// key or value itself; otherwise it is a pointer to it.
+static inline void *
+key_slot(struct hash_table *table, struct bin *bin)
+{
+  return (char *)bin + table->key_offset;
+}
+
+static inline void *
+val_slot(struct hash_table *table, struct bin *bin)
+{
+  return (char *)bin + table->val_offset;
+}
+
+// The pointer in a slot. In a loaded table, it is an offset into the file.
+static inline void *
+slot_ptr(struct hash_table *table, void *slot)
+{
+  if (table->mapping)
+    return (char *)table->mapping + *(uint64_t *)slot;
+  return *(void **)slot;
+}
+
+static inline void *
+bin_key(struct hash_table *table, struct bin *bin)
+{
+  void *slot = key_slot(table, bin);
+  return table->key_type->size ? slot : slot_ptr(table, slot);
 }
 
+static inline void *
+bin_val(struct hash_table *table, struct bin *bin)
+{
+  void *slot = val_slot(table, bin);
+  return table->value_type->size ? slot : slot_ptr(table, slot);
+}
+
+// Inline keys and values are copied when we store them in a bin, so here we
+// only copy those we keep pointers to.
 static inline void *
 copy_key(struct hash_table *table, void const *key)
 {
-  return table->key_type->cpy(key);
+  struct key_type const *kt = table->key_type;
+  if (kt->size)
+    return (void *)key;
+  return table->arena ? kt->arena_cpy(key, table->arena) : kt->cpy(key);
 }
 
 static inline void *
 copy_val(struct hash_table *table, void const *val)
 {
-  return table->value_type->cpy(val);
+  struct value_type const *vt = table->value_type;
+  if (vt->size)
+    return (void *)val;
+  return table->arena ? vt->arena_cpy(val, table->arena) : vt->cpy(val);
 }
 
 static inline void
-free_key(struct hash_table *table, void *key)
+store_key(struct hash_table *table, struct bin *bin, void *key)
 {
-  table->key_type->del(key);
+  if (table->key_type->size)
+    memcpy(key_slot(table, bin), key, table->key_type->size);
+  else
+    *(void **)key_slot(table, bin) = key;
 }
 
 static inline void
-free_val(struct hash_table *table, void *val)
+store_val(struct hash_table *table, struct bin *bin, void *val)
 {
-  table->value_type->del(val);
+  if (table->value_type->size)
+    memcpy(val_slot(table, bin), val, table->value_type->size);
+  else
+    *(void **)val_slot(table, bin) = val;
 }
 
-static inline bool
-is_active_bin(struct bin *bin)
+// Free the key and value in a bin. If they live in the arena, we only count
+// them as garbage.
+static inline void
+free_entry(struct hash_table *table, struct bin *bin)
 {
-  return bin->in_probe && !bin->is_empty;
+  if (table->options.arena) {
+    table->garbage++;
+    return;
+  }
+  if (!table->key_type->size)
+    table->key_type->del(*(void **)key_slot(table, bin));
+  if (!table->value_type->size)
+    table->value_type->del(*(void **)val_slot(table, bin));
+}
+
+// Copy the key and value in a bin that was moved from another arena to ours.
+static void
+recopy_entry(struct hash_table *table, struct bin *bin)
+{
+  if (!table->key_type->size) {
+    void **key = key_slot(table, bin);
+    *key = table->key_type->arena_cpy(*key, table->arena);
+  }
+  if (!table->value_type->size) {
+    void **val = val_slot(table, bin);
+    *val = table->value_type->arena_cpy(*val, table->arena);
+  }
+}
+
+// Set the control byte for bin i, and its mirror.
+static inline void
+set_ctrl(struct hash_table *table, size_t i, uint8_t ctrl)
+{
+  set_ctrl_byte(table->ctrl, table->size, i, ctrl);
 }
 
 // Creating and resizing tables
 
-// add_map_internal is a helper function for add_map that expects us to have
-// already computed the hash_key for the key and copied the key and value. It
-// inserts the hash_key/key -> value mapping in the table.
-static void
-add_map_internal(struct hash_table *table, unsigned int hash_key,
-                 void *key_copy, void *value_copy);
+#define MIN_SIZE 8
+
+// The table grows when this many of its bins hold keys or tombstones. We
+// keep at least one bin empty, however close to one max_load is, so probes
+// always end.
+static inline size_t
+grow_threshold(struct table_options const *options, size_t size)
+{
+  size_t threshold = (size_t)(size * options->max_load);
+  if (threshold >= size)
+    threshold = size - 1;
+  return threshold > 0 ? threshold : 1;
+}
 
-// Initialize the table with `size` bins, and then copy the bins from `begin` to
-// `end` into the table.
+// Initialize the table with `size` empty bins.
 static void
-init_table(struct hash_table *table, unsigned int size, struct bin *begin,
-           struct bin *end)
+init_table(struct hash_table *table, size_t size)
 {
   // Initialize table members
-  table->bins = malloc(size * sizeof *table->bins);
+  table->ctrl = malloc(size + GROUP_WIDTH - 1);
+  table->bins = malloc(size * table->bin_size);
   table->size = size;
   table->used = 0;
   table->active = 0;
+  table->grow_at = grow_threshold(&table->options, size);
+  table->shrink_at =
+      size > MIN_SIZE ? (size_t)(size * table->options.min_load) : 0;
 
-  // Initialize bins
-  struct bin empty_bin = {.in_probe = false, .is_empty = true};
-  for (unsigned int i = 0; i < table->size; i++) {
-    table->bins[i] = empty_bin;
-  }
+  // Initialize bins; only the control bytes need it
+  memset(table->ctrl, CTRL_EMPTY, size + GROUP_WIDTH - 1);
+}
 
-  // Copy the old bins to the new table
-  for (struct bin *bin = begin; bin != end; bin++) {
-    if (!bin->is_empty) {
-      add_map_internal(table, bin->hash_key, bin->key, bin->val);
-    }
+static inline size_t
+align_up(size_t offset, size_t align)
+{
+  return (offset + align - 1) / align * align;
+}
+
+// Place the key and the value after the hash key, and pad the bin so the next
+// bin is aligned as well.
+static void
+init_bin_layout(struct hash_table *table)
+{
+  struct key_type const *kt = table->key_type;
+  struct value_type const *vt = table->value_type;
+  size_t key_size = kt->size ? kt->size : sizeof(void *);
+  size_t key_align = kt->size ? kt->align : _Alignof(void *);
+  size_t val_size = vt->size ? vt->size : sizeof(void *);
+  size_t val_align = vt->size ? vt->align : _Alignof(void *);
+  assert(key_align && key_align <= _Alignof(max_align_t));
+  assert(val_align && val_align <= _Alignof(max_align_t));
+
+  size_t bin_align = _Alignof(struct bin);
+  bin_align = key_align > bin_align ? key_align : bin_align;
+  bin_align = val_align > bin_align ? val_align : bin_align;
+
+  table->key_offset = align_up(sizeof(struct bin), key_align);
+  table->val_offset = align_up(table->key_offset + key_size, val_align);
+  table->bin_size = align_up(table->val_offset + val_size, bin_align);
+}
+
+// The smallest table size that holds `capacity` keys without growing.
+static size_t
+size_for(struct table_options const *options, size_t capacity)
+{
+  size_t size = MIN_SIZE;
+  while (grow_threshold(options, size) <= capacity) {
+    size *= 2;
   }
+  return size;
 }
 
-#define MIN_SIZE 8
+// Fill in the default resize policy where the options don't set one.
+static void
+init_policy(struct table_options *options)
+{
+  if (options->max_load == 0.0)
+    options->max_load = 0.5;
+  if (options->min_load == 0.0)
+    options->min_load = 0.125;
+  if (options->growth_factor == 0)
+    options->growth_factor = 2;
+
+  assert(0.0 < options->max_load && options->max_load < 1.0);
+  unsigned int factor = options->growth_factor;
+  assert(factor >= 2 && (factor & (factor - 1)) == 0);
+  // A table that just grew or shrank must not be ready to shrink again.
+  assert(0.0 < options->min_load &&
+         options->min_load < options->max_load / factor);
+  assert(!options->robin_hood || options->probing == PROBE_LINEAR);
+}
+
+// The number of old bins we move in each operation. The new table has twice
+// as many bins when we grow, so it has room for at least half as many new keys
+// as there are old bins before it must grow again, and moving two bins per
+// operation would be enough to finish in time.
+#define MIGRATE_BINS 8
 
 struct hash_table *
-new_table(struct key_type const *key_type, struct value_type const *value_type)
+new_table_with_options(struct key_type const *key_type,
+                       struct value_type const *value_type,
+                       struct table_options const *options)
 {
+  assert(!options->arena || key_type->size || key_type->arena_cpy);
+  assert(!options->arena || value_type->size || value_type->arena_cpy);
+  assert(key_type->hash || key_type->seeded_hash);
+  assert(!options->random_seed || key_type->seeded_hash);
+
   struct hash_table *table = malloc(sizeof *table);
   table->key_type = key_type;
   table->value_type = value_type;
-  init_table(table, MIN_SIZE, NULL, NULL);
+  table->options = *options;
+  init_policy(&table->options);
+  table->seed = options->random_seed ? hash_random_seed() : 0;
+  table->arena = options->arena ? new_arena() : NULL;
+  table->garbage = 0;
+  table->old = NULL;
+  table->migrate_pos = 0;
+  table->mapping = NULL;
+  table->mapping_size = 0;
+  table->counters = (struct table_counters){0};
+  init_bin_layout(table);
+  init_table(table, size_for(&table->options, options->capacity));
   return table;
 }
 
+struct hash_table *
+new_table(struct key_type const *key_type, struct value_type const *value_type)
+{
+  struct table_options default_options = {0};
+  return new_table_with_options(key_type, value_type, &default_options);
+}
+
+struct hash_table *
+new_table_with_capacity(struct key_type const *key_type,
+                        struct value_type const *value_type,
+                        size_t capacity)
+{
+  struct table_options options = {.capacity = capacity};
+  return new_table_with_options(key_type, value_type, &options);
+}
+
+static size_t
+find_empty(struct hash_table *table, uint64_t hash_key);
+static size_t
+make_room(struct hash_table *table, uint64_t hash_key);
+
+// Find the bin a new key should go in, given that it isn't in the table.
+static inline size_t
+new_key_bin(struct hash_table *table, uint64_t hash_key)
+{
+  return table->options.robin_hood ? make_room(table, hash_key)
+                                   : find_empty(table, hash_key);
+}
+
+// Copy an active bin from another table with the same layout into the empty
+// or deleted bin i. If the key and value are in an arena we are compacting,
+// we copy them to ours.
+static void
+place_bin(struct hash_table *table, size_t i, struct bin const *bin,
+          struct arena const *from_arena)
+{
+  table->used += table->ctrl[i] == CTRL_EMPTY;
+  table->active++;
+  set_ctrl(table, i, h7(bin->hash_key));
+  memcpy(bin_at(table, i), bin, table->bin_size);
+  if (from_arena && from_arena != table->arena)
+    recopy_entry(table, bin_at(table, i));
+}
+
+// Move an active bin from another table with the same layout into this one.
+// The key cannot already be in the table, so we just need an empty bin.
 static void
-resize(struct hash_table *table, unsigned int new_size)
+move_bin(struct hash_table *table, struct bin const *bin,
+         struct arena const *from_arena)
+{
+  place_bin(table, new_key_bin(table, bin->hash_key), bin, from_arena);
+}
+
+// When we resize a table with an arena, we also copy the live keys and
+// values to a new arena if at least half of the old one is garbage. The
+// caller must delete the old arena once the bins are moved.
+static bool
+start_compaction(struct hash_table *table)
 {
+  if (!table->arena || table->garbage < table->active)
+    return false;
+  table->arena = new_arena();
+  table->garbage = 0;
+  return true;
+}
+
+static void
+migrate(struct hash_table *table, size_t no_bins);
+
+// Start an incremental resize. The current bins become the old table, and the
+// table continues with empty bins.
+static void
+start_migration(struct hash_table *table, size_t new_size)
+{
+  // We only keep one old table around, so finish any resize in progress.
+  if (table->old)
+    migrate(table, table->old->size);
+
+  struct hash_table *old = malloc(sizeof *old);
+  *old = *table;
+  old->counters = (struct table_counters){0}; // added back when it is done
+  // The old table only owns the arena if we are moving to a new one.
+  if (!start_compaction(table))
+    old->arena = NULL;
+
+  init_table(table, new_size);
+  table->old = old;
+  table->migrate_pos = 0;
+}
+
+static void
+resize(struct hash_table *table, size_t new_size)
+{
+  table->counters.resizes++;
+  if (table->options.incremental_resize) {
+    start_migration(table, new_size); // migrate() keeps track of the time
+    return;
+  }
+
+  double start = now_seconds();
   // remember the old bins until we have moved them.
-  struct bin *old_bins_begin = table->bins,
-             *old_bins_end = old_bins_begin + table->size;
+  uint8_t *old_ctrl = table->ctrl;
+  char *old_bins = table->bins;
+  size_t old_size = table->size;
+  struct arena *old_arena = table->arena;
+  bool compact = start_compaction(table);
 
-  // Update table and copy the old active bins to it.
-  init_table(table, new_size, old_bins_begin, old_bins_end);
+  // Update table and move the old active bins to it.
+  init_table(table, new_size);
+  for (size_t i = 0; i < old_size; i++) {
+    if (is_full(old_ctrl[i])) {
+      struct bin *bin = (struct bin *)(old_bins + i * table->bin_size);
+      move_bin(table, bin, old_arena);
+    }
+  }
 
   // finally, free memory for old bins
-  free(old_bins_begin);
+  free(old_ctrl);
+  free(old_bins);
+  if (compact)
+    delete_arena(old_arena);
+
+  table->counters.resize_seconds += now_seconds() - start;
+}
+
+void
+reserve(struct hash_table *table, size_t capacity)
+{
+  assert(!table->mapping);
+  size_t size = size_for(&table->options, capacity);
+  if (size > table->size)
+    resize(table, size);
 }
 
 // Deleting tables
 
-// If there is data in a bin, free it
+// If there is data in bin i, free it
 static inline void
-free_bin(struct hash_table *table, struct bin *bin)
+free_bin(struct hash_table *table, size_t i)
 {
-  if (is_active_bin(bin)) {
-    free_key(table, bin->key);
-    free_val(table, bin->val);
-    bin->is_empty = true; // Delete the bin
-    table->active--;      // Same bins in use but one less active
+  if (is_full(table->ctrl[i])) {
+    free_entry(table, bin_at(table, i));
+    set_ctrl(table, i, CTRL_DELETED); // Delete the bin
+    table->active--; // Same bins in use but one less active
   }
 }
 
 void
 delete_table(struct hash_table *table)
 {
-  for (struct bin *bin = table->bins; bin != table->bins + table->size; ++bin) {
-    free_bin(table, bin);
+  if (table->mapping) {
+    munmap(table->mapping, table->mapping_size); // the table owns nothing else
+    free(table);
+    return;
+  }
+  if (table->old)
+    delete_table(table->old);
+  if (table->options.arena) {
+    if (table->arena)
+      delete_arena(table->arena); // frees all keys and values at once
+  } else {
+    for (size_t i = 0; i < table->size; i++) {
+      free_bin(table, i);
+    }
   }
+  free(table->ctrl);
   free(table->bins);
   free(table);
 }
 
 // Lookup
 
-// Check if the bin contains the key. We first check if the bin is active,
-// then if the hash keys match (if they don't, we don't need to call a
-// potentially expensive key comparison function), and finally we compare the
+// Check if the bin contains the key. The control byte already told us that
+// the bin is active and that seven bits of the hash keys match. We check the
+// full hash keys first (if they don't match, we don't need to call a
+// potentially expensive key comparison function), and then we compare the
 // keys.
 static inline bool
-key_in_bin(struct hash_table *table, struct bin *bin, unsigned int hash_key,
+key_in_bin(struct hash_table *table, struct bin *bin, uint64_t hash_key,
            void const *key)
 {
-  return is_active_bin(bin) && bin->hash_key == hash_key &&
-         table->key_type->cmp(bin->key, key);
+  if (bin->hash_key != hash_key)
+    return false;
+  COUNT(table, compares, 1);
+  return table->key_type->cmp(bin_key(table, bin), key);
 }
 
 // Find the bin containing key, or the first bin past the end of its probe.
 // It will never return a bin that is in a probe and empty, since those
 // cannot contain the key and if we need an empty bin we will search for
 // the earliest in the probe using find_empty().
-struct bin *
-find_key(struct hash_table *table, unsigned int hash_key, void const *key)
+static size_t
+find_key(struct hash_table *table, uint64_t hash_key, void const *key)
 {
-  for (unsigned int i = 0; i < table->size; i++) {
-    struct bin *bin = table->bins + p(hash_key, i, table->size);
-    if (!bin->in_probe ||                      // end of probe, or
-        key_in_bin(table, bin, hash_key, key)) // found the key
-      return bin;
+  size_t mask = table->size - 1;
+  COUNT(table, finds, 1);
+  for (size_t i = 0; i < no_groups(table->size); i++) {
+    size_t pos = p(table, hash_key, i);
+    uint8_t const *group = table->ctrl + pos;
+    COUNT(table, probed_groups, 1);
+
+    // Only look at bins where the hash fragment matches
+    for (group_mask m = match_byte(group, h7(hash_key)); m; m &= m - 1) {
+      size_t bin = (pos + first_bit(m)) & mask;
+      if (key_in_bin(table, bin_at(table, bin), hash_key, key))
+        return bin; // found the key
+    }
+
+    // A key is never stored past the end of its probe
+    group_mask empty = match_empty(group);
+    if (empty)
+      return (pos + first_bit(empty)) & mask; // end of probe
+  }
+  abort(); // We should never get here
+}
+
+// Like find_key(), but if the key isn't in the table, return the bin
+// find_empty() would give us instead, so we can insert it without probing
+// again.
+static size_t
+find_key_or_free(struct hash_table *table, uint64_t hash_key, void const *key)
+{
+  size_t mask = table->size - 1;
+  size_t empty = SIZE_MAX; // the first empty or deleted bin
+  COUNT(table, finds, 1);
+  for (size_t i = 0; i < no_groups(table->size); i++) {
+    size_t pos = p(table, hash_key, i);
+    uint8_t const *group = table->ctrl + pos;
+    COUNT(table, probed_groups, 1);
+
+    for (group_mask m = match_byte(group, h7(hash_key)); m; m &= m - 1) {
+      size_t bin = (pos + first_bit(m)) & mask;
+      if (key_in_bin(table, bin_at(table, bin), hash_key, key))
+        return bin;
+    }
+
+    group_mask empty_or_deleted = match_empty_or_deleted(group);
+    if (empty == SIZE_MAX && empty_or_deleted)
+      empty = (pos + first_bit(empty_or_deleted)) & mask;
+    if (match_empty(group))
+      return empty;
   }
-  assert(false); // We should never get here
+  abort(); // We should never get here
+}
+
+static void *
+lookup_internal(struct hash_table *table, uint64_t hash_key,
+                void const *key)
+{
+  size_t i = find_key(table, hash_key, key);
+  if (is_full(table->ctrl[i]))
+    return bin_val(table, bin_at(table, i));
+
+  // If we are resizing, the key might not have been moved yet
+  struct hash_table *old = table->old;
+  if (old && is_full(old->ctrl[i = find_key(old, hash_key, key)]))
+    return bin_val(old, bin_at(old, i));
+
+  return NULL;
+}
+
+uint64_t
+table_hash(struct hash_table *table, void const *key)
+{
+  return hash(table, key);
 }
 
 void *const
 lookup_key(struct hash_table *table, void const *key)
 {
-  struct bin *bin = find_key(table, hash(table, key), key);
-  return bin->in_probe ? bin->val : NULL;
+  return lookup_key_with_hash(table, hash(table, key), key);
+}
+
+void *const
+lookup_key_with_hash(struct hash_table *table, uint64_t hash_key,
+                     void const *key)
+{
+  migrate(table, MIGRATE_BINS);
+  return lookup_internal(table, hash_key, key);
+}
+
+// The number of keys we hash, and prefetch bins for, before we probe.
+#define PREFETCH_BATCH 16
+
+// Start loading the first group and the home bin for a key.
+static inline void
+prefetch_home(struct hash_table *table, uint64_t hash_key)
+{
+  size_t home = hash_key & (table->size - 1);
+  __builtin_prefetch(table->ctrl + home);
+  __builtin_prefetch(bin_at(table, home));
+}
+
+void
+lookup_keys(struct hash_table *table, void const *const keys[], size_t n,
+            void *values[])
+{
+  migrate(table, MIGRATE_BINS);
+
+  uint64_t hash_keys[PREFETCH_BATCH];
+  for (size_t batch = 0; batch < n; batch += PREFETCH_BATCH) {
+    size_t m = n - batch < PREFETCH_BATCH ? n - batch : PREFETCH_BATCH;
+    void const *const *batch_keys = keys + batch;
+
+    // Start loading the bins for each key as soon as we have its hash...
+    for (size_t i = 0; i < m; i++) {
+      hash_keys[i] = hash(table, batch_keys[i]);
+      prefetch_home(table, hash_keys[i]);
+    }
+
+    // ...so they are on their way into the cache when we probe.
+    for (size_t i = 0; i < m; i++) {
+      values[batch + i] = lookup_internal(table, hash_keys[i], batch_keys[i]);
+    }
+  }
+}
+
+void
+lookup_keys_with_hash(struct hash_table *table, uint64_t const hash_keys[],
+                      void const *const keys[], size_t n, void *values[])
+{
+  migrate(table, MIGRATE_BINS);
+
+  for (size_t batch = 0; batch < n; batch += PREFETCH_BATCH) {
+    size_t m = n - batch < PREFETCH_BATCH ? n - batch : PREFETCH_BATCH;
+    for (size_t i = batch; i < batch + m; i++) {
+      prefetch_home(table, hash_keys[i]);
+    }
+    for (size_t i = batch; i < batch + m; i++) {
+      values[i] = lookup_internal(table, hash_keys[i], keys[i]);
+    }
+  }
 }
 
 // Find the first empty bin in its probe.
-struct bin *
-find_empty(struct hash_table *table, unsigned int hash_key)
+static size_t
+find_empty(struct hash_table *table, uint64_t hash_key)
+{
+  size_t mask = table->size - 1;
+  for (size_t i = 0; i < no_groups(table->size); i++) {
+    size_t pos = p(table, hash_key, i);
+    group_mask empty = match_empty_or_deleted(table->ctrl + pos);
+    if (empty)
+      return (pos + first_bit(empty)) & mask;
+  }
+  abort(); // We should never get here
+}
+
+// Incremental resizing
+
+// Move up to no_bins bins from the old table to the new, and get rid of the
+// old table when they are all moved. A moved bin leaves a tombstone behind so
+// we don't find it in the old table after it is deleted from the new.
+static void
+migrate(struct hash_table *table, size_t no_bins)
+{
+  struct hash_table *old = table->old;
+  if (!old)
+    return;
+
+  double start = now_seconds();
+  size_t end = table->migrate_pos + no_bins;
+  if (no_bins > old->size - table->migrate_pos)
+    end = old->size;
+  for (size_t i = table->migrate_pos; i < end; i++) {
+    if (is_full(old->ctrl[i])) {
+      move_bin(table, bin_at(old, i), old->arena);
+      set_ctrl(old, i, CTRL_DELETED);
+      old->active--;
+    }
+  }
+  table->migrate_pos = end;
+
+  if (end == old->size) {
+    add_counters(&table->counters, &old->counters);
+    delete_table(old); // there are no keys left to free
+    table->old = NULL;
+  }
+  table->counters.resize_seconds += now_seconds() - start;
+}
+
+// Delete the key from the old table if it is there.
+static void
+delete_from_old(struct hash_table *table, uint64_t hash_key,
+                void const *key)
+{
+  if (table->old)
+    free_bin(table->old, find_key(table->old, hash_key, key));
+}
+
+static inline size_t
+total_active(struct hash_table *table)
+{
+  return table->active + (table->old ? table->old->active : 0);
+}
+
+// The bins we will have used when the keys left in the old table are moved
+// here. We grow when this reaches grow_at, so there is room for them, and the
+// probes always end at an empty bin, in both tables.
+static inline size_t
+used_after_migration(struct hash_table *table)
+{
+  return table->used + (table->old ? table->old->active : 0);
+}
+
+// Robin Hood hashing
+
+// How far the entry in bin i is from its home bin.
+static inline size_t
+probe_dist(struct hash_table *table, size_t i)
+{
+  return (i - bin_at(table, i)->hash_key) & (table->size - 1);
+}
+
+// Move the entry in bin `from` to the empty bin `to`.
+static inline void
+move_within(struct hash_table *table, size_t from, size_t to)
+{
+  set_ctrl(table, to, table->ctrl[from]);
+  memcpy(bin_at(table, to), bin_at(table, from), table->bin_size);
+}
+
+// The first empty bin from bin i and onwards.
+static size_t
+next_empty(struct hash_table *table, size_t i)
 {
-  for (unsigned int i = 0; i < table->size; i++) {
-    struct bin *bin = table->bins + p(hash_key, i, table->size);
-    if (bin->is_empty)
-      return bin;
+  size_t mask = table->size - 1;
+  for (size_t j = 0; j < no_groups(table->size); j++) {
+    size_t pos = (i + j * GROUP_WIDTH) & mask;
+    group_mask empty = match_empty(table->ctrl + pos);
+    if (empty)
+      return (pos + first_bit(empty)) & mask;
+  }
+  abort(); // We should never get here
+}
+
+// A new entry goes before the first entry in its probe that is closer to its
+// own home than the new entry would be. Since each probe is sorted that way,
+// swapping entries down the probe amounts to shifting the rest of the cluster
+// one bin to the right, and then the bin is free for the new entry.
+static size_t
+make_room(struct hash_table *table, uint64_t hash_key)
+{
+  size_t mask = table->size - 1;
+  size_t i = hash_key & mask;
+  for (size_t dist = 0;
+       is_full(table->ctrl[i]) && probe_dist(table, i) >= dist; dist++) {
+    i = (i + 1) & mask;
+  }
+
+  if (is_full(table->ctrl[i])) {
+    size_t end = next_empty(table, i);
+    for (size_t j = end; j != i; j = (j - 1) & mask) {
+      move_within(table, (j - 1) & mask, j);
+    }
+    set_ctrl(table, i, CTRL_EMPTY);
+  }
+  return i;
+}
+
+// Delete the entry in bin i and shift the entries after it in the cluster one
+// bin back, until we reach an entry that is already in its home bin.
+static void
+shift_back(struct hash_table *table, size_t i)
+{
+  size_t mask = table->size - 1;
+  free_entry(table, bin_at(table, i));
+
+  for (size_t j = (i + 1) & mask;
+       is_full(table->ctrl[j]) && probe_dist(table, j) > 0;
+       i = j, j = (j + 1) & mask) {
+    move_within(table, j, i);
+  }
+  set_ctrl(table, i, CTRL_EMPTY);
+  table->used--;
+  table->active--;
+}
+
+// Clearing tombstones
+
+// Rehash the table in its own bins, so the tombstones become empty bins. We
+// first mark the bins with keys as deleted and the tombstones as empty. Then
+// we put each key that is still marked as deleted in the first empty or
+// deleted bin in its probe. If that bin is marked as deleted, it holds a key
+// that we haven't placed yet, so we swap the two and go on with that key.
+static void
+purge_tombstones(struct hash_table *table)
+{
+  double start = now_seconds();
+  for (size_t i = 0; i < table->size; i++) {
+    set_ctrl(table, i, is_full(table->ctrl[i]) ? CTRL_DELETED : CTRL_EMPTY);
+  }
+
+  char *tmp = malloc(table->bin_size);
+  for (size_t i = 0; i < table->size; i++) {
+    if (table->ctrl[i] != CTRL_DELETED)
+      continue;
+    uint64_t hash_key = bin_at(table, i)->hash_key;
+    size_t target = find_empty(table, hash_key);
+
+    // If the key's bin is in the group we would probe first anyway, it can
+    // stay where it is.
+    if (probe_index(table, hash_key, i) ==
+        probe_index(table, hash_key, target)) {
+      set_ctrl(table, i, h7(hash_key));
+      continue;
+    }
+
+    if (table->ctrl[target] == CTRL_EMPTY) {
+      memcpy(bin_at(table, target), bin_at(table, i), table->bin_size);
+      set_ctrl(table, target, h7(hash_key));
+      set_ctrl(table, i, CTRL_EMPTY);
+    } else {
+      memcpy(tmp, bin_at(table, target), table->bin_size);
+      memcpy(bin_at(table, target), bin_at(table, i), table->bin_size);
+      memcpy(bin_at(table, i), tmp, table->bin_size);
+      set_ctrl(table, target, h7(hash_key));
+      i--; // bin i now holds a key we haven't placed
+    }
   }
-  assert(false); // We should never get here
+  free(tmp);
+
+  table->used = table->active;
+  table->counters.purges++;
+  table->counters.resize_seconds += now_seconds() - start;
+}
+
+// When the table is full, we grow it, unless most of the used bins are
+// tombstones. Then clearing them makes enough room.
+static void
+grow(struct hash_table *table)
+{
+  if (table->old)
+    migrate(table, table->old->size); // we can only purge our own bins
+  if (table->active <= table->grow_at / 2 && table->active < table->used)
+    purge_tombstones(table);
+  else
+    resize(table, table->size * table->options.growth_factor);
 }
 
 // Insertion
 static inline void
-store_in_bin(struct hash_table *table, struct bin *bin, unsigned int hash_key,
+store_in_bin(struct hash_table *table, size_t bin, uint64_t hash_key,
              void *key, void *value)
 {
-  // Update counters based on current state of bin.
-  table->active += !!bin->is_empty; // inc if the bin is empty
-  table->used += !bin->in_probe;    // inc if the bin hasn't been used before
-
   // Free any key or value currently in the bin.
   free_bin(table, bin);
 
+  // Update counters based on current state of bin.
+  table->active++;                              // the bin is empty now
+  table->used += table->ctrl[bin] == CTRL_EMPTY; // inc if not used before
+
   // Store the new key and value in the bin.
-  *bin = (struct bin){
-      .in_probe = true,
-      .is_empty = false,
-      .hash_key = hash_key,
-      .key = key,
-      .val = value,
-  };
+  set_ctrl(table, bin, h7(hash_key));
+  bin_at(table, bin)->hash_key = hash_key;
+  store_key(table, bin_at(table, bin), key);
+  store_val(table, bin_at(table, bin), value);
 }
 
-struct bin *
-get_bin(struct hash_table *table, unsigned int hash_key, void *const key)
+static size_t
+get_bin(struct hash_table *table, uint64_t hash_key, void *const key)
 {
-  struct bin *bin = find_key(table, hash_key, key);
-  return bin->in_probe ? bin : find_empty(table, hash_key);
+  size_t bin = find_key(table, hash_key, key);
+  return is_full(table->ctrl[bin]) ? bin : new_key_bin(table, hash_key);
 }
 
+// add_map_internal is a helper function for add_map that expects us to have
+// already computed the hash_key for the key and copied the key and value. It
+// inserts the hash_key/key -> value mapping in the table.
 static void
-add_map_internal(struct hash_table *table, unsigned int hash_key,
+add_map_internal(struct hash_table *table, uint64_t hash_key,
                  void *key_copy, void *value_copy)
 {
-  struct bin *bin = get_bin(table, hash_key, key_copy);
+  size_t bin = get_bin(table, hash_key, key_copy);
   store_in_bin(table, bin, hash_key, key_copy, value_copy);
 
-  if (table->used > table->size / 2)
-    resize(table, table->size * 2);
+  if (used_after_migration(table) >= table->grow_at)
+    grow(table);
 }
 
 void
 add_map(struct hash_table *table, void const *key, void const *value)
 {
-  unsigned int hash_key = hash(table, key);
+  add_map_with_hash(table, hash(table, key), key, value);
+}
+
+void
+add_map_with_hash(struct hash_table *table, uint64_t hash_key,
+                  void const *key, void const *value)
+{
+  assert(!table->mapping);
+  migrate(table, MIGRATE_BINS);
+
+  delete_from_old(table, hash_key, key); // the new mapping replaces it
   void *key_copy = copy_key(table, key);
   void *value_copy = copy_val(table, value);
   add_map_internal(table, hash_key, key_copy, value_copy);
 }
 
+void
+add_map_take(struct hash_table *table, void *key, void *value)
+{
+  add_map_take_with_hash(table, hash(table, key), key, value);
+}
+
+void
+add_map_take_with_hash(struct hash_table *table, uint64_t hash_key, void *key,
+                       void *value)
+{
+  assert(!table->options.arena); // the arena owns everything in the table
+  assert(!table->mapping);
+  migrate(table, MIGRATE_BINS);
+
+  delete_from_old(table, hash_key, key); // the new mapping replaces it
+  add_map_internal(table, hash_key, key, value);
+}
+
+// Add n mappings, copying the keys and values unless we take them.
+static void
+add_many(struct hash_table *table, void const *const keys[],
+         void const *const values[], size_t n, bool take)
+{
+  assert(!take || !table->options.arena);
+  // The keys still in the old table need bins here as well
+  reserve(table, used_after_migration(table) + n);
+
+  // Hash and prefetch a batch of keys at a time, like lookup_keys()
+  uint64_t hash_keys[PREFETCH_BATCH];
+  for (size_t batch = 0; batch < n; batch += PREFETCH_BATCH) {
+    size_t m = n - batch < PREFETCH_BATCH ? n - batch : PREFETCH_BATCH;
+    for (size_t i = 0; i < m; i++) {
+      hash_keys[i] = hash(table, keys[batch + i]);
+      prefetch_home(table, hash_keys[i]);
+    }
+    for (size_t i = 0; i < m; i++) {
+      void const *key = keys[batch + i];
+      void const *value = values[batch + i];
+      migrate(table, MIGRATE_BINS);
+      delete_from_old(table, hash_keys[i], key);
+      if (take)
+        add_map_internal(table, hash_keys[i], (void *)key, (void *)value);
+      else
+        add_map_internal(table, hash_keys[i], copy_key(table, key),
+                         copy_val(table, value));
+    }
+  }
+}
+
+void
+add_maps(struct hash_table *table, void const *const keys[],
+         void const *const values[], size_t n)
+{
+  add_many(table, keys, values, n, false);
+}
+
+void
+add_maps_take(struct hash_table *table, void *const keys[],
+              void *const values[], size_t n)
+{
+  add_many(table, (void const *const *)keys, (void const *const *)values, n,
+           true);
+}
+
+struct hash_table *
+build_table(struct key_type const *key_type,
+            struct value_type const *value_type, void const *const keys[],
+            void const *const values[], size_t n)
+{
+  struct hash_table *table = new_table_with_capacity(key_type, value_type, n);
+  add_maps(table, keys, values, n);
+  return table;
+}
+
+// Find or insert
+
+void *
+find_or_insert(struct hash_table *table, void const *key, bool *inserted)
+{
+  return find_or_insert_with_hash(table, hash(table, key), key, inserted);
+}
+
+void *
+find_or_insert_with_hash(struct hash_table *table, uint64_t hash_key,
+                         void const *key, bool *inserted)
+{
+  assert(!table->mapping);
+  migrate(table, MIGRATE_BINS);
+
+  size_t bin = find_key_or_free(table, hash_key, key);
+  if (is_full(table->ctrl[bin])) {
+    *inserted = false;
+    return val_slot(table, bin_at(table, bin));
+  }
+
+  // Make room before we add the key, so the slot we return stays put. After
+  // growing, the key may have moved here from the old table, so we look
+  // again.
+  if (used_after_migration(table) + (table->ctrl[bin] == CTRL_EMPTY) >=
+      table->grow_at) {
+    grow(table);
+    return find_or_insert_with_hash(table, hash_key, key, inserted);
+  }
+  if (table->options.robin_hood)
+    bin = make_room(table, hash_key);
+
+  // If we are resizing, the key might not have been moved yet. Then we move
+  // it now.
+  struct hash_table *old = table->old;
+  size_t i;
+  if (old && is_full(old->ctrl[i = find_key(old, hash_key, key)])) {
+    place_bin(table, bin, bin_at(old, i), old->arena);
+    set_ctrl(old, i, CTRL_DELETED);
+    old->active--;
+    *inserted = false;
+    return val_slot(table, bin_at(table, bin));
+  }
+
+  table->used += table->ctrl[bin] == CTRL_EMPTY;
+  table->active++;
+  set_ctrl(table, bin, h7(hash_key));
+  bin_at(table, bin)->hash_key = hash_key;
+  store_key(table, bin_at(table, bin), copy_key(table, key));
+  void *slot = val_slot(table, bin_at(table, bin));
+  memset(slot, 0, table->value_type->size ? table->value_type->size
+                                          : sizeof(void *));
+  *inserted = true;
+  return slot;
+}
+
 // Deletion
 
 void
 delete_key(struct hash_table *table, void const *key)
 {
-  struct bin *bin = find_key(table, hash(table, key), key);
-  free_bin(table, bin);
+  delete_key_with_hash(table, hash(table, key), key);
+}
+
+void
+delete_key_with_hash(struct hash_table *table, uint64_t hash_key,
+                     void const *key)
+{
+  assert(!table->mapping);
+  migrate(table, MIGRATE_BINS);
+
+  size_t bin = find_key(table, hash_key, key);
+  if (!is_full(table->ctrl[bin]))
+    delete_from_old(table, hash_key, key);
+  else if (table->options.robin_hood)
+    shift_back(table, bin);
+  else
+    free_bin(table, bin);
 
-  if (table->active < table->size / 8 && table->size > MIN_SIZE)
+  if (total_active(table) < table->shrink_at)
     resize(table, table->size / 2);
 }
+
+// Saving and loading
+
+// A table file starts with this header. The control bytes, the bins, and the
+// keys and values that aren't inline follow at the offsets it gives.
+struct table_file_header {
+  char magic[8];
+  uint64_t size;
+  uint64_t used;
+  uint64_t active;
+  uint64_t bin_size;
+  uint64_t key_offset;
+  uint64_t val_offset;
+  uint64_t key_size; // of inline keys, or zero
+  uint64_t val_size; // of inline values, or zero
+  uint64_t probing;
+  uint64_t seed;
+  uint64_t ctrl_offset;
+  uint64_t bins_offset;
+  uint64_t data_offset;
+  uint64_t file_size;
+};
+
+// The last byte is the version of the format.
+#define TABLE_FILE_MAGIC "oa_map\0\1"
+// The control bytes and bins start at multiples of this, and keys and values
+// at multiples of TABLE_FILE_DATA_ALIGN.
+#define TABLE_FILE_ALIGN _Alignof(max_align_t)
+#define TABLE_FILE_DATA_ALIGN 8
+// We mirror enough control bytes for any group width.
+#define TABLE_FILE_MIRROR 31
+
+_Static_assert(sizeof(void *) <= sizeof(uint64_t),
+               "offsets must fit in pointer slots");
+
+// Write zeros up to offset `to` in the file.
+static void
+pad_to(FILE *file, uint64_t *pos, uint64_t to)
+{
+  static char const zeros[TABLE_FILE_ALIGN];
+  while (*pos < to) {
+    size_t n = to - *pos < sizeof zeros ? to - *pos : sizeof zeros;
+    fwrite(zeros, 1, n, file);
+    *pos += n;
+  }
+}
+
+// The offset of the next n bytes of keys and values, when the ones we have
+// placed so far end at *end.
+static uint64_t
+place_data(uint64_t *end, size_t n)
+{
+  uint64_t offset = align_up(*end, TABLE_FILE_DATA_ALIGN);
+  *end = offset + n;
+  return offset;
+}
+
+// Write a key or value where place_data() put it.
+static void
+write_data(FILE *file, uint64_t *pos, void const *data, size_t n)
+{
+  pad_to(file, pos, align_up(*pos, TABLE_FILE_DATA_ALIGN));
+  fwrite(data, 1, n, file);
+  *pos += n;
+}
+
+bool
+save_table(struct hash_table *table, char const *path)
+{
+  struct key_type const *kt = table->key_type;
+  struct value_type const *vt = table->value_type;
+  assert(kt->size || kt->data_size);
+  assert(vt->size || vt->data_size);
+  assert(!table->mapping); // its bins hold offsets, not pointers
+  if (table->old)
+    migrate(table, table->old->size); // all the keys must be in our bins
+
+  struct table_file_header header = {
+      .magic = TABLE_FILE_MAGIC,
+      .size = table->size,
+      .used = table->used,
+      .active = table->active,
+      .bin_size = table->bin_size,
+      .key_offset = table->key_offset,
+      .val_offset = table->val_offset,
+      .key_size = kt->size,
+      .val_size = vt->size,
+      .probing = table->options.probing,
+      .seed = table->seed,
+  };
+  header.ctrl_offset = align_up(sizeof header, TABLE_FILE_ALIGN);
+  header.bins_offset = align_up(
+      header.ctrl_offset + table->size + TABLE_FILE_MIRROR, TABLE_FILE_ALIGN);
+  header.data_offset = align_up(
+      header.bins_offset + table->size * table->bin_size, TABLE_FILE_ALIGN);
+
+  FILE *file = fopen(path, "wb");
+  if (!file)
+    return false;
+
+  // The header needs the file size, so we write it last.
+  uint64_t pos = 0;
+  pad_to(file, &pos, header.ctrl_offset);
+  fwrite(table->ctrl, 1, table->size, file);
+  for (size_t i = 0; i < TABLE_FILE_MIRROR; i++) {
+    fputc(table->ctrl[i % table->size], file);
+  }
+  pos += table->size + TABLE_FILE_MIRROR;
+
+  pad_to(file, &pos, header.bins_offset);
+  char *bin = malloc(table->bin_size);
+  uint64_t end = header.data_offset;
+  for (size_t i = 0; i < table->size; i++) {
+    memset(bin, 0, table->bin_size); // don't write what's left in free bins
+    if (is_full(table->ctrl[i])) {
+      memcpy(bin, bin_at(table, i), table->bin_size);
+      if (!kt->size) {
+        void **slot = (void **)(bin + table->key_offset);
+        *(uint64_t *)slot = place_data(&end, kt->data_size(*slot, SIZE_MAX));
+      }
+      if (!vt->size) {
+        void **slot = (void **)(bin + table->val_offset);
+        *(uint64_t *)slot = place_data(&end, vt->data_size(*slot, SIZE_MAX));
+      }
+    }
+    fwrite(bin, 1, table->bin_size, file);
+  }
+  free(bin);
+  pos += table->size * table->bin_size;
+
+  // The keys and values, in the order we placed them
+  pad_to(file, &pos, header.data_offset);
+  for (size_t i = 0; i < table->size; i++) {
+    if (!is_full(table->ctrl[i]))
+      continue;
+    if (!kt->size) {
+      void *key = bin_key(table, bin_at(table, i));
+      write_data(file, &pos, key, kt->data_size(key, SIZE_MAX));
+    }
+    if (!vt->size) {
+      void *val = bin_val(table, bin_at(table, i));
+      write_data(file, &pos, val, vt->data_size(val, SIZE_MAX));
+    }
+  }
+  assert(pos == end);
+  header.file_size = pos;
+
+  rewind(file);
+  fwrite(&header, sizeof header, 1, file);
+  bool ok = !ferror(file);
+  return fclose(file) == 0 && ok;
+}
+
+// Is [offset, offset + length) inside [start, end)? Written so the sums
+// can't overflow, whatever the file says.
+static inline bool
+in_bounds(uint64_t offset, uint64_t length, uint64_t start, uint64_t end)
+{
+  return start <= offset && offset <= end && length <= end - offset;
+}
+
+// Check that a file of file_size bytes has a header we can use with table's
+// key and value types, and that the control bytes, bins and data it points
+// to are inside the file, in that order.
+static bool
+header_matches(struct table_file_header const *header,
+               struct hash_table const *table, size_t file_size)
+{
+  if (file_size < sizeof *header)
+    return false;
+  uint64_t size = header->size;
+  bool layout_ok =
+      memcmp(header->magic, TABLE_FILE_MAGIC, sizeof header->magic) == 0 &&
+      header->file_size == file_size && size >= MIN_SIZE &&
+      (size & (size - 1)) == 0 && header->active <= header->used &&
+      header->used < size && header->probing <= PROBE_DOUBLE_HASH &&
+      header->key_size == table->key_type->size &&
+      header->val_size == table->value_type->size &&
+      header->bin_size == table->bin_size &&
+      header->key_offset == table->key_offset &&
+      header->val_offset == table->val_offset &&
+      header->bins_offset % TABLE_FILE_ALIGN == 0;
+  if (!layout_ok)
+    return false;
+
+  uint64_t ctrl_end = header->ctrl_offset + size + TABLE_FILE_MIRROR;
+  if (!in_bounds(header->ctrl_offset, size + TABLE_FILE_MIRROR,
+                 sizeof *header, file_size) ||
+      header->bins_offset < ctrl_end ||
+      header->bins_offset > file_size ||
+      size > (file_size - header->bins_offset) / header->bin_size)
+    return false;
+  uint64_t bins_end = header->bins_offset + size * header->bin_size;
+  return in_bounds(header->data_offset, 0, bins_end, file_size);
+}
+
+// Is the key or value a slot points to after the bins and inside the file?
+static bool
+data_in_bounds(struct hash_table *table,
+               struct table_file_header const *header, void *slot,
+               data_size_func data_size)
+{
+  uint64_t offset = *(uint64_t *)slot;
+  if (!in_bounds(offset, 1, header->data_offset, table->mapping_size))
+    return false;
+  size_t limit = table->mapping_size - offset;
+  return data_size(slot_ptr(table, slot), limit) <= limit;
+}
+
+// Check the control bytes and the keys and values the bins point to, so
+// probes end and lookups don't read past the end of the mapping.
+static bool
+bins_match(struct hash_table *table, struct table_file_header const *header)
+{
+  size_t used = 0, active = 0;
+  for (size_t i = 0; i < TABLE_FILE_MIRROR; i++) {
+    if (table->ctrl[table->size + i] != table->ctrl[i % table->size])
+      return false;
+  }
+  for (size_t i = 0; i < table->size; i++) {
+    uint8_t ctrl = table->ctrl[i];
+    if (ctrl == CTRL_EMPTY)
+      continue;
+    used++;
+    if (!is_full(ctrl)) {
+      if (ctrl != CTRL_DELETED)
+        return false;
+      continue;
+    }
+    active++;
+
+    struct bin *bin = bin_at(table, i);
+    if (!table->key_type->size &&
+        !data_in_bounds(table, header, key_slot(table, bin),
+                        table->key_type->data_size))
+      return false;
+    if (!table->value_type->size &&
+        !data_in_bounds(table, header, val_slot(table, bin),
+                        table->value_type->data_size))
+      return false;
+  }
+  return used == table->used && active == table->active;
+}
+
+struct hash_table *
+load_table(struct key_type const *key_type,
+           struct value_type const *value_type, char const *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  void *mapping = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // the mapping keeps the file open
+  if (mapping == MAP_FAILED)
+    return NULL;
+
+  struct hash_table *table = malloc(sizeof *table);
+  *table = (struct hash_table){.key_type = key_type, .value_type = value_type};
+  init_bin_layout(table);
+  struct table_file_header const *header = mapping;
+  if (!header_matches(header, table, st.st_size)) {
+    munmap(mapping, st.st_size);
+    free(table);
+    return NULL;
+  }
+
+  table->options.probing = header->probing;
+  init_policy(&table->options);
+  table->seed = header->seed;
+  table->ctrl = (uint8_t *)mapping + header->ctrl_offset; // never written
+  table->bins = (char *)mapping + header->bins_offset;
+  table->size = header->size;
+  table->used = header->used;
+  table->active = header->active;
+  table->grow_at = table->size; // it never grows
+  table->mapping = mapping;
+  table->mapping_size = st.st_size;
+  if (!bins_match(table, header)) {
+    delete_table(table); // unmaps the file
+    return NULL;
+  }
+  return table;
+}
+
+// Iteration
+
+// Chunk boundaries are moved forward to empty bins. Robin Hood deletion only
+// shifts keys back within a cluster of full bins, and never across an empty
+// bin, so keys never move between chunks or from the end of a chunk back to
+// its start. Positions are not reduced modulo the table size, so the last
+// chunk can end past the last bin and wrap around to where the first starts.
+static size_t
+chunk_start(struct hash_table *table, size_t chunk, size_t no_chunks)
+{
+  size_t size = table->size;
+  size_t pos = chunk * size / no_chunks;
+  return pos + ((next_empty(table, pos & (size - 1)) - pos) & (size - 1));
+}
+
+static void
+start_chunk(struct table_iter *iter, struct hash_table *table)
+{
+  iter->current = table;
+  iter->pos = chunk_start(table, iter->chunk, iter->no_chunks);
+  iter->end = iter->chunk + 1 < iter->no_chunks
+                  ? chunk_start(table, iter->chunk + 1, iter->no_chunks)
+                  : chunk_start(table, 0, iter->no_chunks) + table->size;
+}
+
+void
+table_iter_init(struct table_iter *iter, struct hash_table *table)
+{
+  table_iter_init_chunk(iter, table, 0, 1);
+}
+
+void
+table_iter_init_chunk(struct table_iter *iter, struct hash_table *table,
+                      size_t chunk, size_t no_chunks)
+{
+  assert(chunk < no_chunks);
+  iter->table = table;
+  iter->chunk = chunk;
+  iter->no_chunks = no_chunks;
+  start_chunk(iter, table);
+}
+
+// We skip a group of empty or deleted bins at a time, using the same matching
+// as probing.
+bool
+table_iter_next(struct table_iter *iter)
+{
+  for (;;) {
+    struct hash_table *table = iter->current;
+    size_t mask = table->size - 1;
+    while (iter->pos < iter->end) {
+      size_t left = iter->end - iter->pos;
+      uint8_t const *group = table->ctrl + (iter->pos & mask);
+      group_mask full = ~match_empty_or_deleted(group) & GROUP_BINS;
+      if (left < GROUP_WIDTH)
+        full &= ((group_mask)1 << left) - 1;
+      if (!full) {
+        iter->pos += GROUP_WIDTH;
+        continue;
+      }
+      iter->pos += first_bit(full);
+      iter->bin = iter->pos++ & mask;
+      iter->key = bin_key(table, bin_at(table, iter->bin));
+      iter->value = bin_val(table, bin_at(table, iter->bin));
+      return true;
+    }
+
+    // During a resize, the keys that haven't moved yet are in the old table.
+    if (table != iter->table || !iter->table->old)
+      return false;
+    start_chunk(iter, iter->table->old);
+  }
+}
+
+void
+table_iter_delete(struct table_iter *iter)
+{
+  struct hash_table *table = iter->current;
+  assert(!table->mapping);
+  if (table->options.robin_hood && table == iter->table) {
+    // The next key in the cluster, if any, moves into this bin.
+    shift_back(table, iter->bin);
+    iter->pos--;
+  } else {
+    free_bin(table, iter->bin);
+  }
+}
+
+// Statistics
+
+// The number of groups find_key() looks at before it finds the key in bin i.
+static inline size_t
+probe_length(struct hash_table *table, size_t i)
+{
+  return probe_index(table, bin_at(table, i)->hash_key, i) + 1;
+}
+
+// Add the bins and keys of one table to the statistics.
+static void
+add_table_stats(struct hash_table *table, struct table_stats *stats,
+                unsigned long *total_length)
+{
+  stats->size += table->size;
+  stats->used += table->used;
+  stats->active += table->active;
+  for (size_t i = 0; i < table->size; i++) {
+    if (!is_full(table->ctrl[i]))
+      continue;
+    size_t length = probe_length(table, i);
+    size_t bucket = length - 1;
+    if (bucket >= TABLE_STATS_BUCKETS)
+      bucket = TABLE_STATS_BUCKETS - 1;
+    stats->probe_lengths[bucket]++;
+    if (length > stats->max_probe_length)
+      stats->max_probe_length = length;
+    *total_length += length;
+  }
+  add_counters(&stats->counters, &table->counters);
+}
+
+void
+table_stats(struct hash_table *table, struct table_stats *stats)
+{
+  *stats = (struct table_stats){0};
+  unsigned long total_length = 0;
+  add_table_stats(table, stats, &total_length);
+  if (table->old)
+    add_table_stats(table->old, stats, &total_length);
+
+  size_t tombstones = stats->used - stats->active;
+  stats->load_factor = (double)stats->used / stats->size;
+  stats->tombstone_fraction = (double)tombstones / stats->size;
+  stats->mean_probe_length =
+      stats->active ? (double)total_length / stats->active : 0.0;
+}
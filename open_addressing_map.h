@@ -2,56 +2,329 @@
 #ifndef OPEN_ADDRESSING_H
 #define OPEN_ADDRESSING_H
 
+#include "arena.h"
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-typedef unsigned int (*hash_func)(void const *);
+typedef uint64_t (*hash_func)(void const *);
+typedef uint64_t (*seeded_hash_func)(void const *, uint64_t seed);
 typedef bool (*compare_func)(void const *, void const *);
 typedef void (*destructor_func)(void *);
 typedef void *(*copy_func)(void const *);
+typedef void *(*arena_copy_func)(void const *, struct arena *);
+typedef size_t (*data_size_func)(void const *, size_t limit);
 
+// Keys and values are copied into the table with cpy and freed with del, and
+// the table holds pointers to them. If a type has a size, however, its keys or
+// values are stored inline in the bins instead; they are copied with memcpy,
+// so they must be plain data, and cpy and del are not used. Tables with an
+// arena copy keys and values into it with arena_cpy instead of cpy.
+//
+// A key type can have a seeded hash instead of, or as well as, a plain one.
+// Tables use the seeded hash if there is one, with a seed of zero unless
+// they are created with the random_seed option. hash.h has both kinds.
+//
+// Tables with keys or values that aren't inline can only be saved with
+// save_table() if their type has a data_size, the number of bytes a key or
+// value pointer points to, and those bytes must be all there is to the key
+// or value. data_size must not read more than limit bytes, and if the key or
+// value doesn't end within them it returns something larger than limit;
+// load_table() passes what is left of the file, so a damaged file can't make
+// it read past the end.
 struct key_type {
   hash_func hash;
+  seeded_hash_func seeded_hash;
   compare_func cmp;
   copy_func cpy;
   destructor_func del;
+  arena_copy_func arena_cpy;
+  data_size_func data_size;
+  size_t size;  // size of inline keys, or zero
+  size_t align; // alignment of inline keys
 };
 
 struct value_type {
   copy_func cpy;
   destructor_func del;
+  arena_copy_func arena_cpy;
+  data_size_func data_size;
+  size_t size;  // size of inline values, or zero
+  size_t align; // alignment of inline values
 };
 
+// Initialiser for the size and alignment of a type stored inline.
+#define STORE_INLINE(TYPE) .size = sizeof(TYPE), .align = _Alignof(TYPE)
+
+// A bin starts with the cached hash key, and the key and the value follow at
+// key_offset and val_offset in the bin, either inline or as pointers. The
+// layout depends on the key and value types, so bins are bin_size bytes apart.
 struct bin {
-  int in_probe : 1; // The bin is part of a sequence of used bins
-  int is_empty : 1; // The bin does not contain a value (but might still be in
-                    // a probe sequence)
+  uint64_t hash_key; // cached hash key
+};
+
+// The order we probe groups of bins in. Linear probing looks at the groups
+// after the home bin one by one, triangular probing skips 0, 1, 2, ...
+// groups ahead, and double hashing skips an odd number of groups given by the
+// hash key. All of them visit every bin in a table. Keys with nearby home
+// bins share the groups linear probing looks at, so a hash function that puts
+// many keys close together gives long probes; the other two spread such keys
+// out, at the cost of a less cache-friendly probe.
+enum probing {
+  PROBE_LINEAR, // the default
+  PROBE_TRIANGULAR,
+  PROBE_DOUBLE_HASH,
+};
+
+// Options for a new table. The zero-initialised options give the default
+// table with tombstones for deleted keys.
+struct table_options {
+  // Robin Hood insertion keeps each probe sorted by distance from the home bin,
+  // and deletion shifts the rest of the probe back instead of leaving a
+  // tombstone, so `used` and `active` are always the same. It needs linear
+  // probing.
+  bool robin_hood;
+  enum probing probing;
+  // Resize by moving a few bins with each add_map(), lookup_key() and
+  // delete_key() instead of moving them all at once.
+  bool incremental_resize;
+  // Copy keys and values into an arena owned by the table. They are never
+  // freed one at a time; the live ones are copied to a fresh arena when the
+  // table is resized and enough of them are dead, and the rest go away with
+  // the table.
+  bool arena;
+  // Hash keys with a random seed, so nobody can choose keys that collide in
+  // this table. The key type must have a seeded hash.
+  bool random_seed;
+  // The number of keys the table should have room for before it first grows.
+  size_t capacity;
+
+  // The resize policy; zero gives the default. The table grows by
+  // growth_factor (a power of two, default 2) when max_load of its bins hold
+  // keys or tombstones (default 1/2), and shrinks to half its size when fewer
+  // than min_load hold keys (default 1/8). max_load must be less than one, and
+  // at least one bin is always left empty however close to one it is.
+  // min_load must be less than max_load / growth_factor, so a table that has
+  // just grown or shrunk is not ready to resize again. If the table is full
+  // mostly of tombstones, they are cleared without resizing.
+  double max_load;
+  double min_load;
+  unsigned int growth_factor;
+};
 
-  unsigned int hash_key; // cached hash key
-  void *key;             // pointer to the actual key
-  void *val;             // pointer to the value
+// Counters for table_stats(). The ones on the lookup path cost a little on
+// every probe, so they are only updated when open_addressing_map.c is compiled
+// with OA_MAP_STATS; otherwise they stay zero.
+struct table_counters {
+  unsigned long finds;         // searches for a key (OA_MAP_STATS)
+  unsigned long probed_groups; // groups of bins they looked at (OA_MAP_STATS)
+  unsigned long compares;      // calls to the key comparison (OA_MAP_STATS)
+  unsigned long resizes;
+  unsigned long purges;  // tombstones cleared without resizing
+  double resize_seconds; // time spent moving bins to resized or purged tables
 };
 
 struct hash_table {
-  struct bin *bins;
-  unsigned int size;
-  unsigned int used;
-  unsigned int active;
+  uint8_t *ctrl; // control bytes (see control_bytes.h) and their mirror
+  char *bins;    // size bins of bin_size bytes each
+  size_t bin_size;
+  size_t key_offset;
+  size_t val_offset;
+  size_t size;
+  size_t used;
+  size_t active;
+  size_t grow_at;   // grow when used reaches this
+  size_t shrink_at; // shrink when active is smaller than this
   struct key_type const *key_type;
   struct value_type const *value_type;
+  struct table_options options;
+  uint64_t seed; // for the key type's seeded hash
+  struct arena *arena;  // where keys and values are copied to, if anywhere
+  size_t garbage; // entries deleted since the arena was compacted
+
+  // During an incremental resize, the keys that haven't been moved yet are in
+  // the old table, and the counters above only cover the new bins.
+  struct hash_table *old;
+  size_t migrate_pos; // next bin in old to move
+
+  // A table loaded with load_table() lives in a read-only mapping of its
+  // file, and the key and value pointers in its bins are offsets into it.
+  void *mapping;
+  size_t mapping_size;
+
+  struct table_counters counters;
 };
 
 struct hash_table *
 new_table(struct key_type const *key_type, struct value_type const *value_type);
+struct hash_table *
+new_table_with_options(struct key_type const *key_type,
+                       struct value_type const *value_type,
+                       struct table_options const *options);
+struct hash_table *
+new_table_with_capacity(struct key_type const *key_type,
+                        struct value_type const *value_type,
+                        size_t capacity);
+
+// Build a table from n keys and values, sized so it never has to resize
+// while we insert them.
+struct hash_table *
+build_table(struct key_type const *key_type,
+            struct value_type const *value_type, void const *const keys[],
+            void const *const values[], size_t n);
 
 void
 delete_table(struct hash_table *table);
 
+// Make room for capacity keys, so the table doesn't grow until there are
+// more keys than that (counting deleted keys that still hold a bin, and keys
+// still waiting to move from the old table during an incremental resize).
+void
+reserve(struct hash_table *table, size_t capacity);
+
 void
 add_map(struct hash_table *table, void const *key, void const *value);
+// Add n mappings, after reserving room for all of them.
+void
+add_maps(struct hash_table *table, void const *const keys[],
+         void const *const values[], size_t n);
 void
 delete_key(struct hash_table *table, void const *key);
 void *const
 lookup_key(struct hash_table *table, void const *key);
 
+// Add mappings for keys and values the caller has already allocated, without
+// copying them. The table takes ownership and frees them with del, as if it
+// had made them with cpy; inline keys and values are still copied into the
+// bins, and the caller keeps what they point to. Tables with an arena can't
+// take keys and values.
+void
+add_map_take(struct hash_table *table, void *key, void *value);
+void
+add_maps_take(struct hash_table *table, void *const keys[],
+              void *const values[], size_t n);
+
+// Look up n keys at once and put their values, or NULL, in values. Hashing a
+// batch of keys before probing for any of them lets the memory accesses for
+// all their bins overlap.
+void
+lookup_keys(struct hash_table *table, void const *const keys[], size_t n,
+            void *values[]);
+
+// Find the key, or add it if it isn't there, with a single probe, and give us
+// the slot in its bin where the value is stored. Inline values are stored in
+// the slot itself; for other values the slot holds a pointer to the value.
+// A new key gets a zeroed slot, and then *inserted is true. The caller must
+// store a value there that the table can free with the value type's del (or
+// one in table->arena, if the table has one). The slot is only valid until
+// the table is next modified.
+void *
+find_or_insert(struct hash_table *table, void const *key, bool *inserted);
+
+// The same operations for keys we have already hashed, so a key can be
+// hashed once and then used with several tables. The hash key must be the
+// one table_hash() gives for the key; tables with the same key type and
+// seed hash keys the same way.
+uint64_t
+table_hash(struct hash_table *table, void const *key);
+void
+add_map_with_hash(struct hash_table *table, uint64_t hash_key,
+                  void const *key, void const *value);
+void
+delete_key_with_hash(struct hash_table *table, uint64_t hash_key,
+                     void const *key);
+void *const
+lookup_key_with_hash(struct hash_table *table, uint64_t hash_key,
+                     void const *key);
+void
+lookup_keys_with_hash(struct hash_table *table, uint64_t const hash_keys[],
+                      void const *const keys[], size_t n, void *values[]);
+void *
+find_or_insert_with_hash(struct hash_table *table, uint64_t hash_key,
+                         void const *key, bool *inserted);
+void
+add_map_take_with_hash(struct hash_table *table, uint64_t hash_key, void *key,
+                       void *value);
+
+// Saving and loading
+
+// save_table() writes a table to a file that load_table() maps into memory
+// read-only. The file holds the control bytes and bins as they are, with
+// offsets into the file instead of pointers to keys and values, so a loaded
+// table can be used at once without building anything, and processes that
+// load the same file share its pages. A loaded table can be looked up and
+// iterated over, but not modified, and delete_table() unmaps it.
+//
+// The file is in the byte order of the machine that wrote it. load_table()
+// must get key and value types with the same layout and the same hash
+// function as the table that was saved; it checks what it can and returns
+// NULL if the file doesn't match or can't be mapped. save_table() returns
+// false if the file can't be written.
+bool
+save_table(struct hash_table *table, char const *path);
+struct hash_table *
+load_table(struct key_type const *key_type,
+           struct value_type const *value_type, char const *path);
+
+// Iteration
+
+// An iterator over the keys and values in a table, or in one of no_chunks
+// chunks of it, so several threads can scan a table between them. While we
+// iterate, the table must not be modified except by deleting the current
+// key with table_iter_delete(). That never resizes the table, and every other
+// key is still visited exactly once. During an incremental resize, lookups
+// move keys between bins, so they count as modifications too.
+struct table_iter {
+  struct hash_table *table;
+  struct hash_table *current; // the table, or the old one during a resize
+  size_t chunk;
+  size_t no_chunks;
+  size_t pos; // the next bin, counted from the start of current's bins
+  size_t end; // the end of the chunk, counted the same way
+  size_t bin; // the bin the key and value are in
+  void *key;
+  void *value;
+};
+
+void
+table_iter_init(struct table_iter *iter, struct hash_table *table);
+// chunk is from 0 to no_chunks - 1.
+void
+table_iter_init_chunk(struct table_iter *iter, struct hash_table *table,
+                      size_t chunk, size_t no_chunks);
+// Move to the next key and value, or return false if there are no more.
+bool
+table_iter_next(struct table_iter *iter);
+void
+table_iter_delete(struct table_iter *iter);
+
+// for every key and value in TABLE, with a struct table_iter *ITER.
+#define TABLE_FOREACH(ITER, TABLE)                                             \
+  for (table_iter_init(ITER, TABLE); table_iter_next(ITER);)
+
+// Statistics
+
+// Probe lengths are counted in groups of bins, the number find_key() looks
+// at to find a key, so a key in the first group it probes has length one.
+#define TABLE_STATS_BUCKETS 16
+struct table_stats {
+  size_t size;
+  size_t used;   // bins with a key or a tombstone
+  size_t active; // bins with a key
+  double load_factor;        // used / size
+  double tombstone_fraction; // (used - active) / size
+  // probe_lengths[i] is the number of keys with probe length i + 1, and the
+  // last bucket also holds the keys with longer probes.
+  size_t probe_lengths[TABLE_STATS_BUCKETS];
+  size_t max_probe_length;
+  double mean_probe_length;
+  struct table_counters counters;
+};
+
+// Collect statistics about the table. This looks at every bin, so it isn't
+// something to do on every operation. During an incremental resize, the
+// statistics cover both the old and the new bins.
+void
+table_stats(struct hash_table *table, struct table_stats *stats);
+
 #endif
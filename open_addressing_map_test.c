@@ -1,4 +1,5 @@
 
+#include "hash.h"
 #include "open_addressing_map.h"
 #include <assert.h>
 #include <stdint.h>
@@ -6,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 static uint32_t
 random_key()
@@ -40,6 +42,36 @@ u32_dup(void const *p)
   return new;
 }
 
+static void *
+u32_arena_dup(void const *p, struct arena *arena)
+{
+  uint32_t *new = arena_alloc(arena, sizeof(uint32_t), _Alignof(uint32_t));
+  *new = *(uint32_t *)p;
+  return new;
+}
+
+static void *
+str_arena_dup(void const *p, struct arena *arena)
+{
+  size_t n = strlen(p) + 1;
+  char *new = arena_alloc(arena, n, 1);
+  memcpy(new, p, n);
+  return new;
+}
+
+static size_t
+u32_size(void const *p, size_t limit)
+{
+  return sizeof(uint32_t);
+}
+
+static size_t
+str_size(void const *p, size_t limit)
+{
+  char const *end = memchr(p, '\0', limit);
+  return end ? (size_t)(end - (char const *)p) + 1 : limit + 1;
+}
+
 static bool
 u32_cmp(void const *ap, void const *bp)
 {
@@ -56,41 +88,66 @@ str_cmp(void const *ap, void const *bp)
   return strcmp(a, b) == 0;
 }
 
-unsigned int
-u32_hash(void const *key)
-{
-  // truely stupid hash but we need something for the test
-  return *(uint32_t *)key ^ 0xdeadbeef;
-}
+struct key_type ui32_key_type = {.cmp = u32_cmp,
+                                 .del = free,
+                                 .hash = hash_u32_key,
+                                 .cpy = u32_dup,
+                                 .arena_cpy = u32_arena_dup,
+                                 .data_size = u32_size};
+struct value_type ui32_val_type = {.del = free,
+                                   .cpy = u32_dup,
+                                   .arena_cpy = u32_arena_dup,
+                                   .data_size = u32_size};
+
+struct key_type ui32_inline_key_type = {
+    .cmp = u32_cmp, .hash = hash_u32_key, STORE_INLINE(uint32_t)};
+struct value_type ui32_inline_val_type = {STORE_INLINE(uint32_t)};
+
+struct key_type ui32_seeded_key_type = {
+    .cmp = u32_cmp, .seeded_hash = hash_u32_seeded_key, STORE_INLINE(uint32_t)};
 
-#define STR_EQ(A, B) (strcmp(A, B) == 0)
-unsigned int
-str_hash(void const *p)
+struct key_type str_key_type = {.cmp = str_cmp,
+                                .del = free,
+                                .hash = hash_str_key,
+                                .cpy = str_dup,
+                                .arena_cpy = str_arena_dup,
+                                .data_size = str_size};
+struct value_type str_val_type = {.del = free,
+                                  .cpy = str_dup,
+                                  .arena_cpy = str_arena_dup,
+                                  .data_size = str_size};
+
+// Look up all the keys and as many missing keys in one batch.
+static void
+test_lookup_keys(struct hash_table *map, uint32_t *keys, int no_elms)
 {
-  char *x = (char *)p;
-  unsigned int h = 0;
-  for (char *p = x; *p; p++) {
-    h = 31 * h + *p;
+  uint32_t unused_key = 0;
+  void const **batch = malloc(2 * no_elms * sizeof *batch);
+  void **values = malloc(2 * no_elms * sizeof *values);
+  for (int i = 0; i < no_elms; ++i) {
+    batch[2 * i] = &keys[i];
+    batch[2 * i + 1] = &unused_key;
   }
-  return h;
+  lookup_keys(map, batch, 2 * no_elms, values);
+  for (int i = 0; i < no_elms; ++i) {
+    assert(u32_cmp(values[2 * i], &keys[i]));
+    assert(values[2 * i + 1] == 0);
+  }
+  free(batch);
+  free(values);
 }
 
-struct key_type ui32_key_type = {
-    .cmp = u32_cmp, .del = free, .hash = u32_hash, .cpy = u32_dup};
-struct value_type ui32_val_type = {.del = free, .cpy = u32_dup};
-
-struct key_type str_key_type = {
-    .cmp = str_cmp, .del = free, .hash = str_hash, .cpy = str_dup};
-struct value_type str_val_type = {.del = free, .cpy = str_dup};
-
 static void
-test_intp(int no_elms)
+test_intp(int no_elms, struct key_type const *key_type,
+          struct value_type const *value_type,
+          struct table_options const *options)
 {
   uint32_t *keys = (uint32_t *)malloc(no_elms * sizeof(uint32_t));
   for (int i = 0; i < no_elms; ++i) {
     keys[i] = random_key();
   }
-  struct hash_table *map = new_table(&ui32_key_type, &ui32_val_type);
+  struct hash_table *map =
+      new_table_with_options(key_type, value_type, options);
   clock_t start = clock();
   for (int i = 0; i < no_elms; ++i) {
     add_map(map, &keys[i], &keys[i]);
@@ -99,6 +156,7 @@ test_intp(int no_elms)
     void *val = lookup_key(map, &keys[i]);
     assert(u32_cmp(val, &keys[i]));
   }
+  test_lookup_keys(map, keys, no_elms);
   uint32_t unused_key = 0;
   for (int i = 0; i < no_elms; ++i) {
     void *val = lookup_key(map, &unused_key);
@@ -117,8 +175,431 @@ test_intp(int no_elms)
 
   free(keys);
 
-  printf("active: %u\n", map->active);
-  printf("used: %u\n", map->used);
+  printf("active: %zu\n", map->active);
+  printf("used: %zu\n", map->used);
+
+  delete_table(map);
+}
+
+// Every key gets the same hash, so all keys share one long probe sequence
+// that spans several groups of bins.
+static uint64_t
+collide_hash(void const *key)
+{
+  return 42;
+}
+
+struct key_type collide_key_type = {.cmp = u32_cmp,
+                                    .del = free,
+                                    .hash = collide_hash,
+                                    .cpy = u32_dup,
+                                    .arena_cpy = u32_arena_dup};
+
+static void
+test_collisions(int no_elms, struct table_options const *options)
+{
+  struct hash_table *map =
+      new_table_with_options(&collide_key_type, &ui32_val_type, options);
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    add_map(map, &i, &i);
+  }
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    uint32_t *val = lookup_key(map, &i);
+    assert(val && *val == i);
+  }
+  for (uint32_t i = no_elms; i < 2 * no_elms; ++i) {
+    assert(lookup_key(map, &i) == 0);
+  }
+  for (uint32_t i = 0; i < no_elms; i += 2) {
+    delete_key(map, &i);
+  }
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    uint32_t *val = lookup_key(map, &i);
+    assert(i % 2 == 0 ? val == 0 : *val == i);
+  }
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    uint32_t val = 2 * i;
+    add_map(map, &i, &val);
+  }
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    uint32_t *val = lookup_key(map, &i);
+    assert(*val == 2 * i);
+  }
+  assert(map->active == no_elms);
+
+  delete_table(map);
+}
+
+// Keep the table at a fixed number of keys while replacing them. With Robin
+// Hood deletion there are no tombstones to build up.
+static void
+test_churn(int no_elms)
+{
+  struct table_options options = {.robin_hood = true};
+  struct hash_table *map = new_table_with_options(
+      &ui32_inline_key_type, &ui32_inline_val_type, &options);
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    add_map(map, &i, &i);
+  }
+  size_t size = map->size;
+  for (uint32_t i = no_elms; i < 100 * no_elms; ++i) {
+    uint32_t old_key = i - no_elms;
+    delete_key(map, &old_key);
+    add_map(map, &i, &i);
+    assert(map->used == map->active);
+    assert(map->size == size);
+  }
+  for (uint32_t i = 0; i < 100 * no_elms; ++i) {
+    uint32_t *val = lookup_key(map, &i);
+    assert(i < 99 * no_elms ? val == 0 : *val == i);
+  }
+
+  delete_table(map);
+}
+
+// All keys must be found while the bins are moved from the old table, and
+// lookups alone should finish the move.
+static void
+test_incremental(int no_elms)
+{
+  struct table_options options = {.incremental_resize = true};
+  struct hash_table *map = new_table_with_options(
+      &ui32_inline_key_type, &ui32_inline_val_type, &options);
+  bool resizing = false;
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    add_map(map, &i, &i);
+    if (map->old) {
+      // The statistics cover the keys in both tables
+      struct table_stats stats;
+      table_stats(map, &stats);
+      assert(stats.active == i + 1);
+      resizing = true;
+    }
+    for (uint32_t j = 0; j <= i; ++j) {
+      uint32_t *val = lookup_key(map, &j);
+      assert(*val == j);
+    }
+  }
+  assert(resizing);
+
+  if (map->old) {
+    uint32_t unused_key = no_elms;
+    size_t old_size = map->old->size;
+    for (size_t i = 0; i < old_size && map->old; ++i) {
+      assert(lookup_key(map, &unused_key) == 0);
+    }
+    assert(map->old == NULL);
+  }
+  assert(map->active == no_elms);
+
+  delete_table(map);
+}
+
+// With a high max_load, the keys still waiting in the old table can fill the
+// new one during a migration. Probes must still find an empty bin, both when
+// we insert and when we look up keys that aren't there.
+static void
+test_incremental_full(int no_elms)
+{
+  double max_loads[] = {0.875, 0.9375};
+  for (size_t l = 0; l < sizeof max_loads / sizeof *max_loads; ++l) {
+    for (int robin_hood = 0; robin_hood <= 1; ++robin_hood) {
+      struct table_options options = {.incremental_resize = true,
+                                       .robin_hood = robin_hood,
+                                       .max_load = max_loads[l]};
+      struct hash_table *map = new_table_with_options(
+          &ui32_inline_key_type, &ui32_inline_val_type, &options);
+      for (uint32_t i = 0; i < no_elms; ++i) {
+        add_map(map, &i, &i);
+        for (uint32_t j = no_elms; j < no_elms + 4; ++j) {
+          assert(lookup_key(map, &j) == NULL);
+          delete_key(map, &j);
+        }
+      }
+      for (uint32_t i = 0; i < no_elms; ++i) {
+        uint32_t *val = lookup_key(map, &i);
+        assert(val && *val == i);
+      }
+      delete_table(map);
+    }
+  }
+}
+
+// Adding a batch of keys in the middle of a migration must make room for the
+// keys still in the old table as well as the new ones.
+static void
+test_incremental_batch(int no_elms)
+{
+  struct table_options options = {
+      .incremental_resize = true, .robin_hood = true, .max_load = 0.75};
+  struct hash_table *map = new_table_with_options(
+      &ui32_inline_key_type, &ui32_inline_val_type, &options);
+  uint32_t n = 0;
+  while (!map->old || map->old->size < 16) {
+    add_map(map, &n, &n);
+    n++;
+  }
+  assert(map->old->active > 8);
+
+  uint32_t batch = no_elms > 20 ? no_elms : 20;
+  uint32_t *keys = malloc(batch * sizeof *keys);
+  void const **key_ptrs = malloc(batch * sizeof *key_ptrs);
+  for (uint32_t i = 0; i < batch; ++i) {
+    keys[i] = n + i;
+    key_ptrs[i] = &keys[i];
+  }
+  add_maps(map, key_ptrs, key_ptrs, batch);
+  for (uint32_t i = 0; i < n + batch; ++i) {
+    uint32_t *val = lookup_key(map, &i);
+    assert(val && *val == i);
+  }
+
+  free(keys);
+  free(key_ptrs);
+  delete_table(map);
+}
+
+// Tables with room for all the keys up front should never resize.
+static void
+test_capacity(int no_elms)
+{
+  uint32_t *keys = malloc(no_elms * sizeof *keys);
+  void const **key_ptrs = malloc(no_elms * sizeof *key_ptrs);
+  for (int i = 0; i < no_elms; ++i) {
+    keys[i] = i;
+    key_ptrs[i] = &keys[i];
+  }
+
+  struct hash_table *map = new_table_with_capacity(
+      &ui32_inline_key_type, &ui32_inline_val_type, no_elms);
+  size_t size = map->size;
+  for (int i = 0; i < no_elms; ++i) {
+    add_map(map, &keys[i], &keys[i]);
+    assert(map->size == size);
+  }
+  delete_table(map);
+
+  map = new_table(&ui32_key_type, &ui32_val_type);
+  reserve(map, no_elms);
+  assert(map->size == size);
+  add_maps(map, key_ptrs, key_ptrs, no_elms);
+  assert(map->size == size);
+  delete_table(map);
+
+  map = build_table(&ui32_key_type, &ui32_val_type, key_ptrs, key_ptrs,
+                    no_elms);
+  assert(map->size == size);
+  assert(map->active == no_elms);
+  for (int i = 0; i < no_elms; ++i) {
+    uint32_t *val = lookup_key(map, &keys[i]);
+    assert(*val == keys[i]);
+  }
+  delete_table(map);
+
+  free(key_ptrs);
+  free(keys);
+}
+
+// Tables with random seeds hash the same keys differently, but find them
+// all the same.
+static void
+test_seed(int no_elms)
+{
+  struct table_options options = {.random_seed = true};
+  struct hash_table *a = new_table_with_options(
+      &ui32_seeded_key_type, &ui32_inline_val_type, &options);
+  struct hash_table *b = new_table_with_options(
+      &ui32_seeded_key_type, &ui32_inline_val_type, &options);
+  assert(a->seed != b->seed);
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    add_map(a, &i, &i);
+    add_map(b, &i, &i);
+  }
+  for (uint32_t i = 0; i < 2 * no_elms; ++i) {
+    uint32_t *val_a = lookup_key(a, &i), *val_b = lookup_key(b, &i);
+    assert(i < no_elms ? *val_a == i && *val_b == i : !val_a && !val_b);
+  }
+  delete_table(a);
+  delete_table(b);
+}
+
+// Count how often each key occurs, updating the counts in place.
+static void
+test_find_or_insert(int no_elms, struct key_type const *key_type,
+                    struct table_options const *options)
+{
+  struct hash_table *map =
+      new_table_with_options(key_type, &ui32_inline_val_type, options);
+  for (uint32_t round = 0; round < 3; ++round) {
+    for (uint32_t i = 0; i < no_elms; ++i) {
+      bool inserted;
+      uint32_t *count = find_or_insert(map, &i, &inserted);
+      assert(inserted == (round == 0 || (round == 2 && i % 3 == 0)));
+      assert(*count == (inserted ? 0 : round));
+      *count = round + 1;
+    }
+    // Deleted keys start over, and leave tombstones behind.
+    for (uint32_t i = 0; round == 1 && i < no_elms; i += 3) {
+      delete_key(map, &i);
+    }
+  }
+  assert(map->active == no_elms);
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    uint32_t *count = lookup_key(map, &i);
+    assert(*count == 3);
+  }
+  delete_table(map);
+}
+
+// Keys hashed once can be used with several tables that hash the same way,
+// and seeded tables give us their hash with table_hash().
+static void
+test_with_hash(int no_elms)
+{
+  struct table_options robin_hood = {.robin_hood = true};
+  struct table_options incremental = {.incremental_resize = true};
+  struct table_options seeded = {.random_seed = true};
+  struct hash_table *a = new_table_with_options(
+      &ui32_inline_key_type, &ui32_inline_val_type, &robin_hood);
+  struct hash_table *b = new_table_with_options(
+      &ui32_inline_key_type, &ui32_inline_val_type, &incremental);
+  struct hash_table *c = new_table_with_options(
+      &ui32_seeded_key_type, &ui32_inline_val_type, &seeded);
+
+  uint32_t *keys = malloc(2 * no_elms * sizeof *keys);
+  uint64_t *hash_keys = malloc(2 * no_elms * sizeof *hash_keys);
+  void const **key_ptrs = malloc(2 * no_elms * sizeof *key_ptrs);
+  void **values = malloc(2 * no_elms * sizeof *values);
+  for (uint32_t i = 0; i < 2 * no_elms; ++i) {
+    keys[i] = i;
+    key_ptrs[i] = &keys[i];
+    hash_keys[i] = table_hash(a, &keys[i]);
+    assert(hash_keys[i] == table_hash(b, &keys[i]));
+  }
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    add_map_with_hash(a, hash_keys[i], &i, &i);
+    add_map_with_hash(b, hash_keys[i], &i, &i);
+    add_map_with_hash(c, table_hash(c, &i), &i, &i);
+  }
+  for (uint32_t i = 0; i < 2 * no_elms; ++i) {
+    uint32_t *val_a = lookup_key(a, &i);
+    uint32_t *val_b = lookup_key_with_hash(b, hash_keys[i], &i);
+    uint32_t *val_c = lookup_key(c, &i);
+    assert(i < no_elms ? *val_a == i && *val_b == i && *val_c == i
+                       : !val_a && !val_b && !val_c);
+  }
+
+  for (uint32_t i = 0; i < no_elms; i += 2) {
+    delete_key_with_hash(a, hash_keys[i], &i);
+    delete_key_with_hash(b, hash_keys[i], &i);
+    delete_key_with_hash(c, table_hash(c, &i), &i);
+  }
+  lookup_keys_with_hash(b, hash_keys, key_ptrs, 2 * no_elms, values);
+  for (uint32_t i = 0; i < 2 * no_elms; ++i) {
+    bool present = i < no_elms && i % 2;
+    uint32_t *val = values[i];
+    assert(present ? *val == i : !val);
+    assert(!lookup_key(a, &i) == !present);
+    assert(!lookup_key(c, &i) == !present);
+  }
+
+  free(keys);
+  free(hash_keys);
+  free(key_ptrs);
+  free(values);
+  delete_table(a);
+  delete_table(b);
+  delete_table(c);
+}
+
+// Tables grow and shrink according to their policy.
+static void
+test_policy(int no_elms)
+{
+  struct table_options options = {
+      .max_load = 0.75, .min_load = 0.125, .growth_factor = 4};
+  struct hash_table *map = new_table_with_options(
+      &ui32_inline_key_type, &ui32_inline_val_type, &options);
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    size_t size = map->size;
+    add_map(map, &i, &i);
+    assert(map->used <= 0.75 * map->size);
+    assert(map->size == size || map->size == 4 * size);
+  }
+  size_t size = map->size;
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    delete_key(map, &i);
+    assert(map->size == 8 || map->active >= 0.125 * map->size);
+  }
+  assert(map->size < size || size == 8);
+
+  delete_table(map);
+}
+
+// Replacing keys leaves tombstones, and with few live keys they should be
+// cleared without growing the table.
+static void
+test_purge(int no_elms, enum probing probing)
+{
+  struct table_options options = {.capacity = no_elms, .probing = probing};
+  struct hash_table *map = new_table_with_options(
+      &ui32_inline_key_type, &ui32_inline_val_type, &options);
+  size_t size = map->size;
+  uint32_t live = map->grow_at / 2; // few enough that purging makes room
+  for (uint32_t i = 0; i < live; ++i) {
+    add_map(map, &i, &i);
+  }
+  uint32_t end = 10 * size;
+  for (uint32_t i = live; i < end; ++i) {
+    uint32_t old_key = i - live;
+    delete_key(map, &old_key);
+    add_map(map, &i, &i);
+    assert(map->size == size);
+  }
+  assert(map->counters.purges > 0);
+  for (uint32_t i = 0; i < end; ++i) {
+    uint32_t *val = lookup_key(map, &i);
+    assert(i < end - live ? val == 0 : *val == i);
+  }
+
+  delete_table(map);
+}
+
+// The statistics should add up, and show the tombstones deletion leaves.
+static void
+test_stats(int no_elms)
+{
+  struct hash_table *map =
+      new_table(&ui32_inline_key_type, &ui32_inline_val_type);
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    add_map(map, &i, &i);
+  }
+  for (uint32_t i = 0; i < no_elms; i += 2) {
+    delete_key(map, &i);
+  }
+
+  struct table_stats stats;
+  table_stats(map, &stats);
+  assert(stats.size == map->size);
+  assert(stats.used == map->used);
+  assert(stats.active == no_elms / 2);
+  assert(stats.load_factor == (double)map->used / map->size);
+  assert(stats.tombstone_fraction ==
+         (double)(map->used - map->active) / map->size);
+  size_t keys = 0;
+  for (int i = 0; i < TABLE_STATS_BUCKETS; ++i) {
+    keys += stats.probe_lengths[i];
+  }
+  assert(keys == stats.active);
+  assert(stats.active == 0 || stats.mean_probe_length >= 1.0);
+  assert(stats.mean_probe_length <= stats.max_probe_length);
+  assert(stats.counters.resizes > 0 || map->size == 8);
+#ifdef OA_MAP_STATS
+  assert(stats.counters.finds >= no_elms + (no_elms + 1) / 2);
+  assert(stats.counters.probed_groups >= stats.counters.finds);
+#else
+  assert(stats.counters.finds == 0);
+#endif
 
   delete_table(map);
 }
@@ -130,14 +611,15 @@ random_string_key()
   return itoa(key);
 }
 static void
-test_str(int no_elms)
+test_str(int no_elms, struct table_options const *options)
 {
   char **keys = malloc(no_elms * sizeof *keys);
   for (int i = 0; i < no_elms; ++i) {
     keys[i] = random_string_key();
   }
 
-  struct hash_table *map = new_table(&str_key_type, &str_val_type);
+  struct hash_table *map =
+      new_table_with_options(&str_key_type, &str_val_type, options);
   clock_t start = clock();
   for (int i = 0; i < no_elms; ++i) {
     add_map(map, keys[i], keys[i]);
@@ -157,14 +639,200 @@ test_str(int no_elms)
   double elapsed_time = (end - start) / (double)CLOCKS_PER_SEC;
   printf("%g\n", elapsed_time);
 
+  // The table copied the keys, so ours are still ours to free
+  for (int i = 0; i < no_elms; ++i) {
+    free(keys[i]);
+  }
   free(keys);
 
-  printf("active: %u\n", map->active);
-  printf("used: %u\n", map->used);
+  printf("active: %zu\n", map->active);
+  printf("used: %zu\n", map->used);
 
   delete_table(map);
 }
 
+// Count how many times we see each key, in a whole table or in chunks.
+static void
+count_keys(struct hash_table *map, size_t no_chunks, uint32_t *seen)
+{
+  struct table_iter iter;
+  for (size_t chunk = 0; chunk < no_chunks; ++chunk) {
+    for (table_iter_init_chunk(&iter, map, chunk, no_chunks);
+         table_iter_next(&iter);) {
+      uint32_t key = *(uint32_t *)iter.key;
+      assert(*(uint32_t *)iter.value == key);
+      seen[key]++;
+    }
+  }
+}
+
+// Every key is visited once, also while we delete keys as we go.
+static void
+test_iter(int no_elms, struct key_type const *key_type,
+          struct value_type const *value_type,
+          struct table_options const *options)
+{
+  struct hash_table *map =
+      new_table_with_options(key_type, value_type, options);
+  for (uint32_t i = 0; i < 2 * no_elms; ++i) {
+    add_map(map, &i, &i);
+  }
+  for (uint32_t i = no_elms; i < 2 * no_elms; ++i) {
+    delete_key(map, &i); // a sparse table with tombstones
+  }
+  // With incremental resizing, leave some keys in each table.
+  reserve(map, 8 * no_elms);
+  for (uint32_t i = 0; i < no_elms / 4; ++i) {
+    assert(lookup_key(map, &i));
+  }
+
+  uint32_t *seen = calloc(2 * no_elms, sizeof *seen);
+  size_t chunks[] = {1, 4, 7};
+  for (int i = 0; i < sizeof chunks / sizeof *chunks; ++i) {
+    count_keys(map, chunks[i], seen);
+  }
+  for (uint32_t i = 0; i < 2 * no_elms; ++i) {
+    assert(seen[i] == (i < no_elms ? 3 : 0));
+  }
+
+  struct table_iter iter;
+  TABLE_FOREACH(&iter, map)
+  {
+    uint32_t key = *(uint32_t *)iter.key;
+    seen[key]++;
+    if (key % 2)
+      table_iter_delete(&iter);
+  }
+  count_keys(map, 1, seen);
+  for (uint32_t i = 0; i < no_elms; ++i) {
+    assert(seen[i] == (i % 2 ? 4 : 5));
+    assert((lookup_key(map, &i) == NULL) == (i % 2 != 0));
+  }
+
+  free(seen);
+  delete_table(map);
+}
+
+// A saved table, loaded back, has the same keys and values.
+static void
+test_save(int no_elms, struct key_type const *key_type,
+          struct value_type const *value_type,
+          struct table_options const *options)
+{
+  char path[] = "/tmp/oa_map_test_XXXXXX";
+  close(mkstemp(path));
+
+  struct hash_table *map =
+      new_table_with_options(key_type, value_type, options);
+  for (uint32_t i = 0; i < 2 * no_elms; ++i) {
+    add_map(map, &i, &i);
+  }
+  for (uint32_t i = no_elms; i < 2 * no_elms; ++i) {
+    delete_key(map, &i);
+  }
+  assert(save_table(map, path));
+  delete_table(map);
+
+  map = load_table(key_type, value_type, path);
+  assert(map);
+  for (uint32_t i = 0; i < 2 * no_elms; ++i) {
+    uint32_t *val = lookup_key(map, &i);
+    assert(i < no_elms ? *val == i : !val);
+  }
+  size_t no_keys = 0;
+  struct table_iter iter;
+  TABLE_FOREACH(&iter, map)
+  {
+    assert(*(uint32_t *)iter.key == *(uint32_t *)iter.value);
+    no_keys++;
+  }
+  assert(no_keys == no_elms);
+  delete_table(map);
+
+  // The file doesn't match other types.
+  assert(!load_table(&str_key_type, &ui32_inline_val_type, path));
+  unlink(path);
+  assert(!load_table(key_type, value_type, path));
+}
+
+static void
+test_save_str(int no_elms)
+{
+  char path[] = "/tmp/oa_map_test_XXXXXX";
+  close(mkstemp(path));
+
+  struct hash_table *map = new_table(&str_key_type, &str_val_type);
+  for (int i = 0; i < no_elms; ++i) {
+    add_map_take(map, itoa(i), itoa(2 * i));
+  }
+  assert(save_table(map, path));
+  delete_table(map);
+
+  map = load_table(&str_key_type, &str_val_type, path);
+  for (int i = 0; i < 2 * no_elms; ++i) {
+    char *key = itoa(i);
+    char *val = lookup_key(map, key);
+    assert(i < no_elms ? atoi(val) == 2 * i : !val);
+    free(key);
+  }
+  delete_table(map);
+
+  // Replace the last value's terminating zero with characters up to the end
+  // of a page, and fix up the file size, the last field in the header, to
+  // match. The value now runs to the end of the mapping and doesn't end.
+  FILE *file = fopen(path, "r+b");
+  fseek(file, 0, SEEK_END);
+  uint64_t end = ftell(file);
+  uint64_t page = sysconf(_SC_PAGESIZE);
+  uint64_t file_size = (end + page - 1) / page * page;
+  fseek(file, end - 1, SEEK_SET);
+  for (uint64_t pos = end - 1; pos < file_size; pos++) {
+    fputc('x', file);
+  }
+  fseek(file, 8 + 13 * sizeof file_size, SEEK_SET);
+  fwrite(&file_size, sizeof file_size, 1, file);
+  fclose(file);
+  assert(!load_table(&str_key_type, &str_val_type, path));
+  unlink(path);
+}
+
+// The table takes the strings we give it, including those that replace
+// others, and frees them.
+static void
+test_take(int no_elms, struct table_options const *options)
+{
+  struct hash_table *map =
+      new_table_with_options(&str_key_type, &str_val_type, options);
+  for (int i = 0; i < no_elms; ++i) {
+    add_map_take(map, itoa(i), itoa(i));
+  }
+  void **keys = malloc(no_elms * sizeof *keys);
+  void **values = malloc(no_elms * sizeof *values);
+  for (int i = 0; i < no_elms; ++i) {
+    keys[i] = itoa(i);
+    values[i] = itoa(2 * i);
+  }
+  add_maps_take(map, keys, values, no_elms);
+  assert(map->active == no_elms);
+  for (int i = 0; i < no_elms; ++i) {
+    char *key = itoa(i);
+    char *val = lookup_key(map, key);
+    assert(atoi(val) == 2 * i);
+    if (i % 2)
+      delete_key(map, key);
+    free(key);
+  }
+  for (int i = 0; i < no_elms; ++i) {
+    char *key = itoa(i);
+    assert((lookup_key(map, key) == NULL) == (i % 2 != 0));
+    free(key);
+  }
+
+  free(keys);
+  free(values);
+  delete_table(map);
+}
+
 int
 main(int argc, const char *argv[])
 {
@@ -174,8 +842,59 @@ main(int argc, const char *argv[])
   }
 
   int no_elms = atoi(argv[1]);
-  test_intp(no_elms);
-  test_str(no_elms);
+  struct table_options tombstones = {0};
+  struct table_options robin_hood = {.robin_hood = true};
+  struct table_options incremental = {.incremental_resize = true};
+  struct table_options incremental_robin_hood = {.robin_hood = true,
+                                                 .incremental_resize = true};
+  struct table_options arena = {.arena = true};
+  struct table_options arena_incremental = {.arena = true,
+                                            .robin_hood = true,
+                                            .incremental_resize = true};
+  struct table_options triangular = {.probing = PROBE_TRIANGULAR};
+  struct table_options double_hash = {.probing = PROBE_DOUBLE_HASH,
+                                      .incremental_resize = true};
+  struct table_options const *options[] = {
+      &tombstones,
+      &robin_hood,
+      &incremental,
+      &incremental_robin_hood,
+      &arena,
+      &arena_incremental,
+      &triangular,
+      &double_hash,
+  };
+
+  for (int i = 0; i < sizeof options / sizeof *options; i++) {
+    test_intp(no_elms, &ui32_key_type, &ui32_val_type, options[i]);
+    test_intp(no_elms, &ui32_inline_key_type, &ui32_inline_val_type,
+              options[i]);
+    test_str(no_elms, options[i]);
+    test_collisions(no_elms, options[i]);
+    test_find_or_insert(no_elms, &ui32_key_type, options[i]);
+    test_find_or_insert(no_elms, &ui32_inline_key_type, options[i]);
+    if (!options[i]->arena)
+      test_take(no_elms, options[i]);
+    test_iter(no_elms, &ui32_key_type, &ui32_val_type, options[i]);
+    test_save(no_elms, &ui32_key_type, &ui32_val_type, options[i]);
+    test_save(no_elms, &ui32_inline_key_type, &ui32_inline_val_type,
+              options[i]);
+    test_iter(no_elms, &ui32_inline_key_type, &ui32_inline_val_type,
+              options[i]);
+  }
+  test_churn(no_elms);
+  test_incremental(no_elms);
+  test_incremental_full(no_elms);
+  test_incremental_batch(no_elms);
+  test_capacity(no_elms);
+  test_seed(no_elms);
+  test_save_str(no_elms);
+  test_with_hash(no_elms);
+  test_policy(no_elms);
+  test_purge(no_elms, PROBE_LINEAR);
+  test_purge(no_elms, PROBE_TRIANGULAR);
+  test_purge(no_elms, PROBE_DOUBLE_HASH);
+  test_stats(no_elms);
 
   return EXIT_SUCCESS;
 }
@@ -1,4 +1,5 @@
 
+#include "hash.h"
 #include "open_addressing_map.h"
 #include <assert.h>
 #include <stdint.h>
@@ -7,14 +8,6 @@
 #include <string.h>
 #include <time.h>
 
-static void *
-u32_dup(void const *p)
-{
-  uint32_t *new = malloc(sizeof(uint32_t));
-  *new = *(uint32_t *)p;
-  return new;
-}
-
 void *
 str_dup(const void *p)
 {
@@ -26,14 +19,6 @@ str_dup(const void *p)
   return new;
 }
 
-static bool
-u32_cmp(void const *ap, void const *bp)
-{
-  uint32_t a = *(uint32_t *)ap;
-  uint32_t b = *(uint32_t *)bp;
-  return a == b;
-}
-
 static bool
 str_cmp(void const *ap, void const *bp)
 {
@@ -42,28 +27,9 @@ str_cmp(void const *ap, void const *bp)
   return strcmp(a, b) == 0;
 }
 
-unsigned int
-u32_hash(void const *key)
-{
-  // truely stupid hash but we need something for the test
-  return *(uint32_t *)key ^ 0xdeadbeef;
-}
-
-#define STR_EQ(A, B) (strcmp(A, B) == 0)
-unsigned int
-str_hash(void const *p)
-{
-  char *x = (char *)p;
-  unsigned int h = 0;
-  for (char *p = x; *p; p++) {
-    h = 31 * h + *p;
-  }
-  return h;
-}
-
 struct key_type str_key_type = {
-    .cmp = str_cmp, .del = free, .hash = str_hash, .cpy = str_dup};
-struct value_type ui32_val_type = {.del = free, .cpy = u32_dup};
+    .cmp = str_cmp, .del = free, .hash = hash_str_key, .cpy = str_dup};
+struct value_type ui32_val_type = {STORE_INLINE(uint32_t)};
 
 int
 main(int argc, const char *argv[])